@@ -0,0 +1,70 @@
+// Compare transfer completion throughput with and without batched delivery.
+//
+// Usage: node bench/completions.js [seconds=5] [nTransfers=16] [transferSize=64]
+//
+// Needs the test device (0x59e3:0x0a23) used by test/usb.coffee. Reports
+// completions per second, process CPU time, and the share of time the main
+// thread spent busy (event loop utilization) for each delivery mode.
+
+var usb = require('../');
+
+var seconds = +process.argv[2] || 5;
+var nTransfers = +process.argv[3] || 16;
+var transferSize = +process.argv[4] || 64;
+
+var elu = null;
+try {
+  elu = require('perf_hooks').performance.eventLoopUtilization;
+} catch (e) {}
+
+var device = usb.findByIds(0x59e3, 0x0a23);
+if (!device) {
+  console.error('Test device is not attached');
+  process.exit(1);
+}
+device.open();
+var iface = device.interfaces[0];
+iface.claim();
+var endpoint = iface.endpoints[0];
+
+function run(batched, cb) {
+  usb.setBatchCompletions(batched);
+
+  var count = 0;
+  function onData() {
+    count++;
+  }
+  endpoint.on('data', onData);
+
+  var cpu0 = process.cpuUsage();
+  var elu0 = elu && elu();
+  var t0 = process.hrtime();
+  endpoint.startPoll(nTransfers, transferSize);
+
+  setTimeout(function () {
+    var dt = process.hrtime(t0);
+    var elapsed = dt[0] + dt[1] / 1e9;
+    var cpu = process.cpuUsage(cpu0);
+    var busy = elu ? elu(elu0).utilization : NaN;
+    var n = count;
+
+    endpoint.stopPoll(function () {
+      endpoint.removeListener('data', onData);
+      console.log('%s: %d completions/s, process cpu %d%%, main thread busy %s',
+        batched ? 'batched     ' : 'per-transfer',
+        Math.round(n / elapsed),
+        Math.round((cpu.user + cpu.system) / 1e4 / elapsed),
+        elu ? Math.round(busy * 100) + '%' : 'n/a');
+      cb();
+    });
+  }, seconds * 1000);
+}
+
+run(false, function () {
+  run(true, function () {
+    usb.setBatchCompletions(false);
+    iface.release(function () {
+      device.close();
+    });
+  });
+});
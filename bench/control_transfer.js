@@ -0,0 +1,75 @@
+// Control transfer rate of the native Device.controlTransfer() path against
+// the previous one, which built the setup packet in a new Buffer and used a
+// fresh usb.Transfer for every call.
+//
+// Usage: node bench/control_transfer.js [transfers=20000] [length=64] [window=8]
+//
+// Needs the test device (0x59e3:0x0a23) used by test/usb.coffee, and issues
+// vendor IN requests (0xc0, 0x81) like the control transfer tests do.
+
+var usb = require('../');
+
+var transfers = +process.argv[2] || 20000;
+var length = +process.argv[3] || 64;
+var windowSize = +process.argv[4] || 8;
+
+var device = usb.findByIds(0x59e3, 0x0a23);
+if (!device) {
+  console.error('Test device is not attached');
+  process.exit(1);
+}
+device.open();
+
+var SETUP_SIZE = usb.LIBUSB_CONTROL_SETUP_SIZE;
+
+// The JS implementation replaced by Device.__controlTransfer
+function jsControlTransfer(device, bmRequestType, bRequest, wValue, wIndex, wLength, callback) {
+  var buf = new Buffer(wLength + SETUP_SIZE);
+  buf.writeUInt8(bmRequestType, 0);
+  buf.writeUInt8(bRequest, 1);
+  buf.writeUInt16LE(wValue, 2);
+  buf.writeUInt16LE(wIndex, 4);
+  buf.writeUInt16LE(wLength, 6);
+
+  var transfer = new usb.Transfer(device, 0, usb.LIBUSB_TRANSFER_TYPE_CONTROL, device.timeout,
+    function (error, buf, actual) {
+      callback.call(device, error, buf.slice(SETUP_SIZE, SETUP_SIZE + actual));
+    }
+  );
+  transfer.submit(buf);
+}
+
+function run(name, controlTransfer, cb) {
+  var sent = 0, done = 0;
+  var t0 = process.hrtime();
+
+  function onDone(error) {
+    if (error) throw error;
+    if (++done == transfers) {
+      var dt = process.hrtime(t0);
+      var elapsed = dt[0] + dt[1] / 1e9;
+      console.log('%s %d transfers/s', name, Math.round(transfers / elapsed));
+      return cb();
+    }
+    pump();
+  }
+
+  function pump() {
+    while (sent < transfers && sent - done < windowSize) {
+      sent++;
+      controlTransfer(onDone);
+    }
+  }
+
+  pump();
+}
+
+run('js setup packet:', function (cb) {
+  jsControlTransfer(device, 0xc0, 0x81, 0, 0, length, cb);
+}, function () {
+  run('native:         ', function (cb) {
+    device.controlTransfer(0xc0, 0x81, 0, 0, length, cb);
+  }, function () {
+    device.close();
+  });
+});
@@ -0,0 +1,109 @@
+// Lookup latency of the device registry index (src/device_index.h) on a
+// synthetic fleet of devices, against a linear scan of the fleet for every
+// device with the wanted ids. The scan is a lower bound for the old
+// findByIds, which also rescanned the bus and wrapped every device in a JS
+// object first (see bench/find_devices.js for that on real hardware).
+// Indexing is what enumeration costs on top of libusb's own.
+//
+// Build and run:
+//   g++ -O2 -std=c++11 -Isrc bench/device_index.cc -o device_index_bench
+//   ./device_index_bench [devices=200] [lookups=1000000]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "device_index.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static double nsSince(Clock::time_point t0, long n){
+	return std::chrono::duration<double, std::nano>(Clock::now() - t0).count() / n;
+}
+
+int main(int argc, char** argv){
+	long devices = argc > 1 ? atol(argv[1]) : 200;
+	long lookups = argc > 2 ? atol(argv[2]) : 1000000;
+
+	// A rack of hubs on a few buses: 10 products from 4 vendors, each with
+	// a serial number and a device or interface class
+	std::vector<DeviceInfo> fleet(devices);
+	char buf[64];
+	for (long i = 0; i < devices; i++) {
+		DeviceInfo& d = fleet[i];
+		d.device = &fleet[i];
+		d.idVendor = 0x1000 + (uint16_t) (i % 4);
+		d.idProduct = 0x2000 + (uint16_t) (i % 10);
+		snprintf(buf, sizeof(buf), "%ld-%ld.%ld.%ld", i / 343 + 1, i / 49 % 7 + 1, i / 7 % 7 + 1, i % 7 + 1);
+		d.path = buf;
+		snprintf(buf, sizeof(buf), "SN%08ld", i * 7919);
+		d.serial = buf;
+		d.serialKnown = true;
+		d.classes.push_back(0);
+		d.classes.push_back((uint8_t) (i % 3 == 0 ? 0x03 : 0xff));
+	}
+
+	DeviceIndex index;
+	Clock::time_point t0 = Clock::now();
+	for (long i = 0; i < devices; i++) {
+		index.add(new DeviceInfo(fleet[i]));
+	}
+	printf("index %ld devices: %.0f ns per device\n", devices, nsSince(t0, devices));
+
+	long found = 0;
+	DeviceIndex::List out;
+
+	t0 = Clock::now();
+	for (long i = 0; i < lookups; i++) {
+		const DeviceInfo& want = fleet[(i * 31) % devices];
+		out.clear();
+		for (long j = 0; j < devices; j++) {
+			if (fleet[j].idVendor == want.idVendor && fleet[j].idProduct == want.idProduct) {
+				out.push_back(&fleet[j]);
+			}
+		}
+		found += !out.empty();
+	}
+	printf("linear scan by ids: %.1f ns\n", nsSince(t0, lookups));
+
+	t0 = Clock::now();
+	for (long i = 0; i < lookups; i++) {
+		const DeviceInfo& want = fleet[(i * 31) % devices];
+		out.clear();
+		index.findByIds(want.idVendor, want.idProduct, out, 1);
+		found += !out.empty();
+	}
+	printf("index, first by ids: %.1f ns\n", nsSince(t0, lookups));
+
+	t0 = Clock::now();
+	for (long i = 0; i < lookups; i++) {
+		const DeviceInfo& want = fleet[(i * 31) % devices];
+		out.clear();
+		index.findByIds(want.idVendor, want.idProduct, out);
+		found += !out.empty();
+	}
+	printf("index, all by ids: %.1f ns\n", nsSince(t0, lookups));
+
+	t0 = Clock::now();
+	for (long i = 0; i < lookups; i++) {
+		out.clear();
+		index.findBySerial(fleet[(i * 31) % devices].serial, out);
+		found += !out.empty();
+	}
+	printf("index by serial: %.1f ns\n", nsSince(t0, lookups));
+
+	t0 = Clock::now();
+	for (long i = 0; i < lookups; i++) {
+		found += index.findByPath(fleet[(i * 31) % devices].path) != NULL;
+	}
+	printf("index by path: %.1f ns\n", nsSince(t0, lookups));
+
+	t0 = Clock::now();
+	for (long i = 0; i < devices; i++) {
+		delete index.remove(fleet[i].device);
+	}
+	printf("remove %ld devices: %.0f ns per device\n", devices, nsSince(t0, devices));
+
+	return found == 0;
+}
@@ -0,0 +1,42 @@
+// Cost of getDeviceList() when it has to wrap every device afresh, and of
+// reading the descriptors of the devices it returned.
+//
+// Usage: node --expose-gc bench/device_list.js [rounds=200]
+//
+// Devices are only wrapped once while their objects are alive, so each
+// round collects garbage first to drop the previous round's.
+
+var usb = require('../');
+
+if (typeof gc !== 'function') {
+  console.error('Run with node --expose-gc');
+  process.exit(1);
+}
+
+var rounds = +process.argv[2] || 200;
+
+function run(name, touch) {
+  var elapsed = 0, heap = 0, count = 0;
+  for (var i = 0; i < rounds; i++) {
+    gc();
+    var before = process.memoryUsage().heapUsed;
+    var start = process.hrtime();
+    var list = usb.getDeviceList();
+    if (touch) {
+      for (var j = 0; j < list.length; j++) {
+        list[j].deviceDescriptor.idVendor;
+        list[j].portNumbers.length;
+      }
+    }
+    var t = process.hrtime(start);
+    elapsed += t[0] * 1e9 + t[1];
+    heap += process.memoryUsage().heapUsed - before;
+    count += list.length;
+    list = null;
+  }
+  console.log('%s: %d devices, %s us/device, %s bytes heap/device', name, count / rounds,
+    (elapsed / count / 1e3).toFixed(2), (heap / count).toFixed(0));
+}
+
+run('list only', false);
+run('list and read descriptors', true);
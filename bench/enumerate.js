@@ -0,0 +1,55 @@
+// Cold-start inventory: getDeviceList() plus a string read per device on
+// the JS thread, against usb.enumerate().
+//
+// Usage: node bench/enumerate.js [sync|async] [concurrency]
+//
+// Strings are cached once read, so run each variant in its own process.
+// Devices that can't be opened are counted but not read.
+
+var usb = require('../');
+
+var mode = process.argv[2] || 'async';
+var concurrency = +process.argv[3] || undefined;
+
+function sync(done) {
+  var start = Date.now(), list = usb.getDeviceList(), pending = 1, read = 0;
+  function finish() {
+    if (--pending) return;
+    done('getDeviceList + getStringDescriptor', list.length, read, Date.now() - start);
+  }
+  list.forEach(function (device) {
+    var dd = device.deviceDescriptor;
+    try {
+      device.open(false);
+    } catch (e) {
+      return;
+    }
+    [dd.iManufacturer, dd.iProduct, dd.iSerialNumber].forEach(function (index) {
+      if (!index) return;
+      pending++;
+      device.getStringDescriptor(index, function (error) {
+        if (!error) read++;
+        finish();
+      });
+    });
+  });
+  finish();
+}
+
+function async(done) {
+  var start = Date.now();
+  usb.enumerate({strings: true, concurrency: concurrency}, function (error, entries) {
+    if (error) throw error;
+    var read = 0;
+    entries.forEach(function (e) {
+      read += (e.manufacturer !== undefined) + (e.product !== undefined) + (e.serialNumber !== undefined);
+    });
+    done('enumerate', entries.length, read, Date.now() - start);
+  });
+}
+
+function report(name, devices, strings, ms) {
+  console.log('%s: %d devices, %d strings in %d ms', name, devices, strings, ms);
+}
+
+(mode === 'sync' ? sync : async)(report);
@@ -0,0 +1,106 @@
+/* Wakeup cost of libusb's event wait with many open devices: poll() over
+ * every fd, as handle_events() does, against the epoll set it uses on
+ * Linux. Pipes stand in for usbfs device fds; each round makes one of them
+ * readable, waits, finds it in the result and drains it.
+ *
+ * Build and run:
+ *   gcc -O2 bench/epoll_events.c -o epoll_events_bench
+ *   ./epoll_events_bench [fds=500] [rounds=200000]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fail(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int n = argc > 1 ? atoi(argv[1]) : 500;
+	long rounds = argc > 2 ? atol(argv[2]) : 200000;
+	int (*pipes)[2] = calloc(n, sizeof(*pipes));
+	struct pollfd *pfds = calloc(n, sizeof(*pfds));
+	struct epoll_event events[64];
+	struct rlimit rl;
+	double t0, poll_time, epoll_time;
+	char c = 0;
+	long r;
+	int i, epfd;
+
+	/* two fds per pipe */
+	getrlimit(RLIMIT_NOFILE, &rl);
+	if (rl.rlim_cur < (rlim_t)(2 * n + 16)) {
+		rl.rlim_cur = 2 * n + 16;
+		if (setrlimit(RLIMIT_NOFILE, &rl) < 0)
+			fail("setrlimit");
+	}
+
+	epfd = epoll_create1(0);
+	if (epfd < 0)
+		fail("epoll_create1");
+
+	for (i = 0; i < n; i++) {
+		struct epoll_event ev;
+		if (pipe(pipes[i]) < 0)
+			fail("pipe");
+		pfds[i].fd = pipes[i][0];
+		pfds[i].events = POLLIN;
+		ev.events = EPOLLIN;
+		ev.data.fd = pipes[i][0];
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, pipes[i][0], &ev) < 0)
+			fail("epoll_ctl");
+	}
+
+	printf("%d fds, %ld wakeups\n", n, rounds);
+
+	srand(1);
+	t0 = now();
+	for (r = 0; r < rounds; r++) {
+		int k = rand() % n;
+		if (write(pipes[k][1], &c, 1) != 1)
+			fail("write");
+		if (poll(pfds, n, -1) != 1)
+			fail("poll");
+		/* like the backend, scan the array for the ready fd */
+		for (i = 0; i < n; i++) {
+			if (pfds[i].revents) {
+				if (read(pfds[i].fd, &c, 1) != 1)
+					fail("read");
+				break;
+			}
+		}
+	}
+	poll_time = now() - t0;
+
+	srand(1);
+	t0 = now();
+	for (r = 0; r < rounds; r++) {
+		int k = rand() % n;
+		if (write(pipes[k][1], &c, 1) != 1)
+			fail("write");
+		if (epoll_wait(epfd, events, 64, -1) != 1)
+			fail("epoll_wait");
+		if (read(events[0].data.fd, &c, 1) != 1)
+			fail("read");
+	}
+	epoll_time = now() - t0;
+
+	printf("poll():       %8.2f us/wakeup\n", poll_time / rounds * 1e6);
+	printf("epoll_wait(): %8.2f us/wakeup\n", epoll_time / rounds * 1e6);
+	return 0;
+}
@@ -0,0 +1,59 @@
+// Round-trip latency of single control transfers (one in flight at a time),
+// with the event thread as started and then pinned and given a realtime
+// policy with usb.configureEventThread().
+//
+// Usage: node bench/event_latency.js [transfers=5000] [cpu=1] [policy=fifo] [priority=50]
+//
+// Realtime policies need privileges (e.g. run as root or with CAP_SYS_NICE).
+// Needs the test device (0x59e3:0x0a23) used by test/usb.coffee.
+
+var usb = require('../');
+
+var transfers = +process.argv[2] || 5000;
+var cpu = process.argv[3] !== undefined ? +process.argv[3] : 1;
+var policy = process.argv[4] || 'fifo';
+var priority = process.argv[5] !== undefined ? +process.argv[5] : 50;
+
+var device = usb.findByIds(0x59e3, 0x0a23);
+if (!device) {
+  console.error('Test device is not attached');
+  process.exit(1);
+}
+device.open();
+
+function percentile(sorted, p) {
+  return sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))];
+}
+
+function run(name, cb) {
+  var samples = [];
+  var t0;
+
+  function next() {
+    if (samples.length == transfers) {
+      samples.sort(function (a, b) { return a - b; });
+      console.log('%s p50 %d us  p99 %d us  max %d us', name,
+        percentile(samples, 0.5).toFixed(1), percentile(samples, 0.99).toFixed(1),
+        samples[samples.length - 1].toFixed(1));
+      return cb();
+    }
+    t0 = process.hrtime();
+    device.controlTransfer(0xc0, 0x81, 0, 0, 64, function (error) {
+      if (error) throw error;
+      var dt = process.hrtime(t0);
+      samples.push(dt[0] * 1e6 + dt[1] / 1e3);
+      next();
+    });
+  }
+
+  next();
+}
+
+run('default:   ', function () {
+  usb.configureEventThread(device.eventThread || 0, {
+    cpus: [cpu], policy: policy, priority: priority, name: 'usb-events'
+  });
+  run('configured:', function () {
+    device.close();
+  });
+});
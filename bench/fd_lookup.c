@@ -0,0 +1,107 @@
+/* Cost of finding the open handle for each ready fd in the usbfs event
+ * handler with hundreds of devices open: walking the open handle list, as
+ * op_handle_events() used to (under open_devs_lock for the whole pass),
+ * against the fd-indexed table it uses now (one short lock per lookup).
+ *
+ * Build and run:
+ *   gcc -O2 -pthread bench/fd_lookup.c -o fd_lookup_bench
+ *   ./fd_lookup_bench [handles=200] [readyPerWakeup=16] [wakeups=200000]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+struct handle {
+	struct handle *next;
+	int fd;
+	long reaped;
+};
+
+static pthread_mutex_t open_devs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t fd_handles_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	int n = argc > 1 ? atoi(argv[1]) : 200;
+	int ready = argc > 2 ? atoi(argv[2]) : 16;
+	long wakeups = argc > 3 ? atol(argv[3]) : 200000;
+	struct handle *handles = calloc(n, sizeof(*handles));
+	struct handle *open_devs = NULL;
+	struct handle **fd_handles;
+	int *ready_fds = calloc(ready, sizeof(*ready_fds));
+	int base_fd = 16, i, j;
+	double t0, list_time, index_time;
+	long w, missed = 0;
+
+	/* open handles are added at the head of the list, as libusb_open() does */
+	fd_handles = calloc(base_fd + n, sizeof(*fd_handles));
+	for (i = 0; i < n; i++) {
+		handles[i].fd = base_fd + i;
+		handles[i].next = open_devs;
+		open_devs = &handles[i];
+		fd_handles[handles[i].fd] = &handles[i];
+	}
+
+	printf("%d open handles, %d ready fds per wakeup, %ld wakeups\n",
+		n, ready, wakeups);
+
+	srand(1);
+	t0 = now();
+	for (w = 0; w < wakeups; w++) {
+		for (j = 0; j < ready; j++)
+			ready_fds[j] = base_fd + rand() % n;
+
+		pthread_mutex_lock(&open_devs_lock);
+		for (j = 0; j < ready; j++) {
+			struct handle *h;
+			for (h = open_devs; h; h = h->next)
+				if (h->fd == ready_fds[j])
+					break;
+			if (!h) {
+				missed++;
+				continue;
+			}
+			h->reaped++;
+		}
+		pthread_mutex_unlock(&open_devs_lock);
+	}
+	list_time = now() - t0;
+
+	srand(1);
+	t0 = now();
+	for (w = 0; w < wakeups; w++) {
+		for (j = 0; j < ready; j++)
+			ready_fds[j] = base_fd + rand() % n;
+
+		for (j = 0; j < ready; j++) {
+			struct handle *h;
+			pthread_mutex_lock(&fd_handles_lock);
+			h = fd_handles[ready_fds[j]];
+			pthread_mutex_unlock(&fd_handles_lock);
+			if (!h) {
+				missed++;
+				continue;
+			}
+			h->reaped++;
+		}
+	}
+	index_time = now() - t0;
+
+	if (missed) {
+		fprintf(stderr, "%ld lookups failed\n", missed);
+		return 1;
+	}
+
+	printf("open_devs walk: %8.3f us/wakeup\n", list_time / wakeups * 1e6);
+	printf("fd index:       %8.3f us/wakeup\n", index_time / wakeups * 1e6);
+	return 0;
+}
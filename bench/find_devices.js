@@ -0,0 +1,41 @@
+// Device lookup on the real bus: rescanning with getDeviceList() and
+// searching the result, as findByIds used to, against the registry.
+//
+// Usage: node bench/find_devices.js [lookups=2000]
+//
+// Looks up the ids of the last device getDeviceList() returns, so any
+// attached device will do. See bench/device_index.cc for large fleets.
+
+var usb = require('../');
+
+var lookups = +process.argv[2] || 2000;
+
+var devices = usb.getDeviceList();
+if (!devices.length) {
+  console.error('No USB devices found');
+  process.exit(1);
+}
+var want = devices[devices.length - 1].deviceDescriptor;
+
+function scan(vid, pid) {
+  var list = usb.getDeviceList();
+  for (var i = 0; i < list.length; i++) {
+    var dd = list[i].deviceDescriptor;
+    if (dd.idVendor == vid && dd.idProduct == pid) return list[i];
+  }
+}
+
+function run(name, find) {
+  // The first registry lookup enumerates; keep that out of the timing
+  find(want.idVendor, want.idProduct);
+  var t0 = process.hrtime();
+  for (var i = 0; i < lookups; i++) {
+    if (!find(want.idVendor, want.idProduct)) throw new Error('Not found');
+  }
+  var dt = process.hrtime(t0);
+  console.log('%s %d us per lookup', name, ((dt[0] * 1e9 + dt[1]) / lookups / 1e3).toFixed(2));
+}
+
+console.log('%d devices attached', devices.length);
+run('getDeviceList and scan:', scan);
+run('registry:', usb.findByIds);
@@ -0,0 +1,92 @@
+// Post/drain throughput of the completion queue ring (src/mpsc_queue.h)
+// against the mutex-guarded std::queue it replaced, with several producer
+// threads posting concurrently to one consumer.
+//
+// Build and run:
+//   g++ -O2 -std=c++11 -pthread -Isrc bench/mpsc_queue.cc -o mpsc_queue_bench
+//   ./mpsc_queue_bench [producers=4] [itemsPerProducer=2000000]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+#include "mpsc_queue.h"
+
+struct LockedQueue{
+	std::mutex mutex;
+	std::queue<void*> queue;
+
+	bool push(void* v){
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.push(v);
+		return true;
+	}
+
+	// Mirrors the old drain loop: one lock per item
+	bool pop(void*& v){
+		std::lock_guard<std::mutex> lock(mutex);
+		if (queue.empty()) return false;
+		v = queue.front();
+		queue.pop();
+		return true;
+	}
+};
+
+struct RingQueue{
+	MPSCQueue<void*> ring;
+	RingQueue(): ring(4096) {}
+
+	bool push(void* v){ return ring.push(v); }
+	bool pop(void*& v){ return ring.pop(v); }
+};
+
+template <class Q>
+double run(int producers, size_t perProducer){
+	Q q;
+	std::vector<std::thread> threads;
+	size_t total = producers * perProducer;
+
+	auto t0 = std::chrono::steady_clock::now();
+	for (int p = 0; p < producers; p++) {
+		threads.push_back(std::thread([&q, perProducer, p]{
+			for (size_t i = 0; i < perProducer; i++) {
+				void* v = (void*) (((size_t) p << 32) | (i + 1));
+				while (!q.push(v)) std::this_thread::yield();
+			}
+		}));
+	}
+
+	size_t received = 0;
+	std::vector<size_t> last(producers, 0);
+	void* v;
+	while (received < total) {
+		if (!q.pop(v)) {
+			std::this_thread::yield();
+			continue;
+		}
+		size_t p = (size_t) v >> 32, seq = (size_t) v & 0xffffffff;
+		if (seq != last[p] + 1) {
+			fprintf(stderr, "out of order item from producer %zu\n", p);
+			exit(1);
+		}
+		last[p] = seq;
+		received++;
+	}
+	auto t1 = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+	return total / std::chrono::duration<double>(t1 - t0).count();
+}
+
+int main(int argc, char** argv){
+	int producers = argc > 1 ? atoi(argv[1]) : 4;
+	size_t perProducer = argc > 2 ? (size_t) atol(argv[2]) : 2000000;
+
+	printf("%d producers x %zu items\n", producers, perProducer);
+	printf("mutex + std::queue: %8.2f M items/s\n", run<LockedQueue>(producers, perProducer) / 1e6);
+	printf("MPSCQueue ring:     %8.2f M items/s\n", run<RingQueue>(producers, perProducer) / 1e6);
+	return 0;
+}
@@ -0,0 +1,64 @@
+// Message rate of small OUT writes: one transfer per write versus writes
+// coalesced by OutEndpoint.createChannel.
+//
+// Usage: node bench/out_channel.js [messages=20000] [messageSize=16] [window=64]
+//
+// Needs the test device (0x59e3:0x0a23) used by test/usb.coffee. At most
+// `window` writes are outstanding at a time in both modes.
+
+var usb = require('../');
+
+var messages = +process.argv[2] || 20000;
+var messageSize = +process.argv[3] || 16;
+var windowSize = +process.argv[4] || 64;
+
+var device = usb.findByIds(0x59e3, 0x0a23);
+if (!device) {
+  console.error('Test device is not attached');
+  process.exit(1);
+}
+device.open();
+var iface = device.interfaces[0];
+iface.claim();
+var endpoint = iface.endpoints[1];
+var message = new Buffer(messageSize);
+message.fill(0x55);
+
+function run(name, write, cb) {
+  var sent = 0, done = 0;
+  var t0 = process.hrtime();
+
+  function onWritten(error) {
+    if (error) throw error;
+    if (++done == messages) {
+      var dt = process.hrtime(t0);
+      var elapsed = dt[0] + dt[1] / 1e9;
+      console.log('%s %d messages/s', name, Math.round(messages / elapsed));
+      return cb();
+    }
+    pump();
+  }
+
+  function pump() {
+    while (sent < messages && sent - done < windowSize) {
+      sent++;
+      write(message, onWritten);
+    }
+  }
+
+  pump();
+}
+
+var channel = endpoint.createChannel({maxSize: 4096, delay: 1, transfers: 4});
+
+run('transfer per write:', function (data, cb) {
+  endpoint.transfer(data, cb);
+}, function () {
+  run('coalescing channel:', function (data, cb) {
+    channel.write(data, cb);
+  }, function () {
+    iface.release(function () {
+      device.close();
+    });
+  });
+});
@@ -0,0 +1,72 @@
+// IN throughput of pool-mode polling, where every transfer is a JS 'data'
+// event, versus a SharedArrayBuffer ring drained by a worker thread.
+//
+// Usage: node bench/ring_stream.js [seconds=5] [transferSize=64] [transfers=8]
+//
+// Needs the test device (0x59e3:0x0a23) used by test/usb.coffee, and Node
+// with worker_threads for the ring.
+
+var usb = require('../');
+var Worker = require('worker_threads').Worker;
+
+var seconds = +process.argv[2] || 5;
+var size = +process.argv[3] || 64;
+var transfers = +process.argv[4] || 8;
+
+var device = usb.findByIds(0x59e3, 0x0a23);
+if (!device) {
+  console.error('Test device is not attached');
+  process.exit(1);
+}
+device.open();
+var iface = device.interfaces[0];
+iface.claim();
+var endpoint = iface.endpoints[0];
+
+function report(name, bytes, transfersDone, overruns) {
+  console.log('%s %d MB/s, %d transfers/s, %d overruns', name,
+    (bytes / seconds / 1e6).toFixed(2), Math.round(transfersDone / seconds), overruns);
+}
+
+function poll(cb) {
+  var bytes = 0, n = 0;
+  function onData(buf, length, slot) {
+    bytes += length;
+    n++;
+    endpoint.releasePollBuffer(slot);
+  }
+  endpoint.on('data', onData);
+  endpoint.startPoll(transfers, size, {pool: true, nBuffers: 4 * transfers});
+  setTimeout(function () {
+    var overruns = endpoint.getPollStats().overruns;
+    endpoint.stopPoll(function () {
+      endpoint.removeListener('data', onData);
+      report('pool polling:', bytes, n, overruns);
+      cb();
+    });
+  }, seconds * 1000);
+}
+
+function ring(cb) {
+  var r = endpoint.startRing({slots: 256, slotSize: size, transfers: transfers});
+  var worker = new Worker(
+    "var RingReader = require(" + JSON.stringify(require.resolve('../ring_reader')) + ");\n" +
+    "var wt = require('worker_threads');\n" +
+    "var reader = new RingReader(wt.workerData), bytes = 0, n = 0, d;\n" +
+    "while ((d = reader.read())) { bytes += d.length; n++; reader.release(); }\n" +
+    "wt.parentPort.postMessage([bytes, n, reader.overruns()]);\n",
+    {eval: true, workerData: r.buffer});
+  worker.on('message', function (m) {
+    report('SharedArrayBuffer ring:', m[0], m[1], m[2]);
+    cb();
+  });
+  setTimeout(function () { r.stop(); }, seconds * 1000);
+}
+
+poll(function () {
+  ring(function () {
+    iface.release(function () {
+      device.close();
+    });
+  });
+});
@@ -0,0 +1,132 @@
+/* Submit/complete cost of libusb's in-flight transfer timeout tracking with
+ * many transfers in flight: the timeout-sorted flying list libusb used to
+ * keep (linear scan on every submit) against the timeout heap in
+ * libusb/libusb/timeout_heap.h.
+ *
+ * Each step completes a random in-flight transfer and submits a new one
+ * whose deadline is "now" plus a fixed timeout, as a busy event thread does.
+ *
+ * Build and run:
+ *   gcc -O2 -Ilibusb/libusb bench/timeout_heap.c -o timeout_heap_bench
+ *   ./timeout_heap_bench [inFlight=10000] [steps=1000000]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <time.h>
+#include "timeout_heap.h"
+
+struct xfer {
+	struct xfer *prev, *next;
+	struct timeval timeout;
+	struct usbi_timeout_node node;
+};
+
+static int tv_after(const struct timeval *a, const struct timeval *b)
+{
+	return a->tv_sec > b->tv_sec ||
+		(a->tv_sec == b->tv_sec && a->tv_usec > b->tv_usec);
+}
+
+/* the old add_to_flying_list insertion: before the first later timeout */
+static void list_insert(struct xfer *head, struct xfer *x)
+{
+	struct xfer *cur;
+
+	for (cur = head->next; cur != head; cur = cur->next)
+		if (tv_after(&cur->timeout, &x->timeout))
+			break;
+	x->next = cur;
+	x->prev = cur->prev;
+	cur->prev->next = x;
+	cur->prev = x;
+}
+
+static void list_remove(struct xfer *x)
+{
+	x->prev->next = x->next;
+	x->next->prev = x->prev;
+}
+
+static void set_deadline(struct xfer *x, long step)
+{
+	/* 1000ms timeout on a clock that advances 1us per step */
+	long usec = step + 1000000;
+	x->timeout.tv_sec = usec / 1000000;
+	x->timeout.tv_usec = usec % 1000000;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	int n = argc > 1 ? atoi(argv[1]) : 10000;
+	long steps = argc > 2 ? atol(argv[2]) : 1000000;
+	struct xfer *xfers = calloc(n, sizeof(*xfers));
+	struct xfer head;
+	struct usbi_timeout_heap heap;
+	double t0, list_time, heap_time;
+	long i;
+
+	printf("%d transfers in flight, %ld submit/complete steps\n", n, steps);
+
+	/* sorted list */
+	head.next = head.prev = &head;
+	for (i = 0; i < n; i++) {
+		set_deadline(&xfers[i], i - n);
+		list_insert(&head, &xfers[i]);
+	}
+	srand(1);
+	t0 = now();
+	for (i = 0; i < steps; i++) {
+		struct xfer *x = &xfers[rand() % n];
+		list_remove(x);
+		set_deadline(x, i);
+		list_insert(&head, x);
+	}
+	list_time = now() - t0;
+
+	/* heap */
+	usbi_timeout_heap_init(&heap);
+	for (i = 0; i < n; i++) {
+		xfers[i].node.deadline = &xfers[i].timeout;
+		xfers[i].node.pos = 0;
+		set_deadline(&xfers[i], i - n);
+		usbi_timeout_heap_push(&heap, &xfers[i].node);
+	}
+	srand(1);
+	t0 = now();
+	for (i = 0; i < steps; i++) {
+		struct xfer *x = &xfers[rand() % n];
+		usbi_timeout_heap_remove(&heap, &x->node);
+		set_deadline(x, i);
+		usbi_timeout_heap_push(&heap, &x->node);
+	}
+	heap_time = now() - t0;
+
+	/* sanity check: popping yields deadlines in order */
+	{
+		struct usbi_timeout_node *node, *prev = NULL;
+		while ((node = usbi_timeout_heap_top(&heap))) {
+			if (prev && tv_after(prev->deadline, node->deadline)) {
+				fprintf(stderr, "heap order violated\n");
+				return 1;
+			}
+			prev = node;
+			usbi_timeout_heap_remove(&heap, node);
+		}
+	}
+
+	printf("sorted list:  %8.3f M steps/s\n", steps / list_time / 1e6);
+	printf("timeout heap: %8.3f M steps/s\n", steps / heap_time / 1e6);
+
+	usbi_timeout_heap_destroy(&heap);
+	free(xfers);
+	return 0;
+}
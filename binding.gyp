@@ -2,6 +2,7 @@
   'variables': {
     'use_udev%': 1,
     'use_system_libusb%': 'false',
+    'use_poll%': 0,
   },
   'targets': [
     {
@@ -12,8 +13,16 @@
       'target_name': 'usb_bindings',
       'sources': [
         './src/node_usb.cc',
+        './src/event_threads.cc',
+        './src/control_plane.cc',
         './src/device.cc',
+        './src/registry.cc',
+        './src/enumerate.cc',
         './src/transfer.cc',
+        './src/control_transfer.cc',
+        './src/in_stream.cc',
+        './src/ring_stream.cc',
+        './src/out_channel.cc',
         './src/poller.cc',
       ],
       'cflags_cc': [
@@ -29,6 +38,11 @@
       ],
 
       'conditions' : [
+          ['use_poll==1 and OS!="win"', {
+            'defines': [
+              'USE_POLL',
+            ],
+          }],
           ['use_system_libusb=="false"', {
             'dependencies': [
               'libusb.gypi:libusb',
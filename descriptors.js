@@ -0,0 +1,182 @@
+// Views over the raw descriptors of a configuration, as returned by
+// Device.getRawConfigDescriptor(). Nothing is copied or decoded up front:
+// fields are read from the Buffer when accessed, and `extra` is a slice of
+// it. The interface tree is found by one walk over the descriptors the
+// first time `interfaces` is read.
+
+var CONFIG = 0x02;
+var INTERFACE = 0x04;
+var ENDPOINT = 0x05;
+
+// Define getters for [name, offset, size] fields. A field past bLength reads
+// as 0, as libusb reports it (bRefresh and bSynchAddress of short endpoint
+// descriptors).
+function fields(ctor, layout) {
+  ctor.prototype.fields = layout.map(function (f) { return f[0]; });
+  layout.forEach(function (f) {
+    var offset = f[1], size = f[2];
+    Object.defineProperty(ctor.prototype, f[0], {
+      enumerable: true,
+      get: function () {
+        if (offset + size > this.buffer[this.offset]) return 0;
+        return size == 2 ? this.buffer.readUInt16LE(this.offset + offset)
+                         : this.buffer[this.offset + offset];
+      }
+    });
+  });
+}
+
+// Plain object copy of the fields, for JSON and inspection
+function toJSON() {
+  var out = {};
+  for (var i = 0; i < this.fields.length; i++) {
+    out[this.fields[i]] = this[this.fields[i]];
+  }
+  return out;
+}
+
+function EndpointDescriptor(buffer, offset, extraEnd) {
+  this.buffer = buffer;
+  this.offset = offset;
+  this.extra = buffer.slice(offset + buffer[offset], extraEnd);
+}
+
+fields(EndpointDescriptor, [
+  ['bLength', 0, 1],
+  ['bDescriptorType', 1, 1],
+  ['bEndpointAddress', 2, 1],
+  ['bmAttributes', 3, 1],
+  ['wMaxPacketSize', 4, 2],
+  ['bInterval', 6, 1],
+  ['bRefresh', 7, 1],
+  ['bSynchAddress', 8, 1]
+]);
+
+EndpointDescriptor.prototype.toJSON = toJSON;
+
+function InterfaceDescriptor(buffer, offset, extraEnd) {
+  this.buffer = buffer;
+  this.offset = offset;
+  this.extra = buffer.slice(offset + buffer[offset], extraEnd);
+  this.endpoints = [];
+}
+
+fields(InterfaceDescriptor, [
+  ['bLength', 0, 1],
+  ['bDescriptorType', 1, 1],
+  ['bInterfaceNumber', 2, 1],
+  ['bAlternateSetting', 3, 1],
+  ['bNumEndpoints', 4, 1],
+  ['bInterfaceClass', 5, 1],
+  ['bInterfaceSubClass', 6, 1],
+  ['bInterfaceProtocol', 7, 1],
+  ['iInterface', 8, 1]
+]);
+
+InterfaceDescriptor.prototype.toJSON = function () {
+  var out = toJSON.call(this);
+  out.endpoints = this.endpoints.map(function (e) { return e.toJSON(); });
+  return out;
+};
+
+// A configuration descriptor with the same fields and `interfaces` tree
+// (interfaces[i][altSetting].endpoints[j]) as libusb parses it into.
+function ConfigDescriptor(buffer) {
+  if (buffer.length < 9 || buffer[1] != CONFIG) {
+    throw new Error('Not a configuration descriptor');
+  }
+  this.buffer = buffer;
+  this.offset = 0;
+  this._interfaces = null;
+  this._extra = null;
+}
+
+fields(ConfigDescriptor, [
+  ['bLength', 0, 1],
+  ['bDescriptorType', 1, 1],
+  ['wTotalLength', 2, 2],
+  ['bNumInterfaces', 4, 1],
+  ['bConfigurationValue', 5, 1],
+  ['iConfiguration', 6, 1],
+  ['bmAttributes', 7, 1],
+  ['bMaxPower', 8, 1]
+]);
+
+// Every descriptor in the blob, in order, as {bLength, bDescriptorType,
+// offset, data}. Stops at a truncated descriptor.
+ConfigDescriptor.prototype.descriptors = function () {
+  var buffer = this.buffer, list = [];
+  for (var offset = 0; offset + 2 <= buffer.length;) {
+    var length = buffer[offset];
+    if (length < 2 || offset + length > buffer.length) break;
+    list.push({
+      bLength: length,
+      bDescriptorType: buffer[offset + 1],
+      offset: offset,
+      data: buffer.slice(offset, offset + length)
+    });
+    offset += length;
+  }
+  return list;
+};
+
+// Group the walk into interfaces the way libusb does: consecutive
+// alternate settings of one interface number make one interface, and
+// descriptors it doesn't know belong to the `extra` of the one before.
+ConfigDescriptor.prototype._parse = function () {
+  var list = this.descriptors();
+  var buffer = this.buffer;
+  var interfaces = [];
+  var extraEnd = function (i) {
+    for (i++; i < list.length; i++) {
+      var type = list[i].bDescriptorType;
+      if (type == INTERFACE || type == ENDPOINT) return list[i].offset;
+    }
+    return buffer.length;
+  };
+
+  this._extra = buffer.slice(this.bLength, extraEnd(0));
+  var current = null, last = -1;
+  for (var i = 1; i < list.length; i++) {
+    var d = list[i];
+    if (d.bDescriptorType == INTERFACE && d.bLength >= 9) {
+      current = new InterfaceDescriptor(buffer, d.offset, extraEnd(i));
+      if (current.bInterfaceNumber !== last || !interfaces.length) {
+        interfaces.push([]);
+        last = current.bInterfaceNumber;
+      }
+      interfaces[interfaces.length - 1].push(current);
+    } else if (d.bDescriptorType == ENDPOINT && d.bLength >= 7 && current) {
+      current.endpoints.push(new EndpointDescriptor(buffer, d.offset, extraEnd(i)));
+    }
+  }
+  this._interfaces = interfaces;
+};
+
+Object.defineProperty(ConfigDescriptor.prototype, 'interfaces', {
+  enumerable: true,
+  get: function () {
+    if (!this._interfaces) this._parse();
+    return this._interfaces;
+  }
+});
+
+Object.defineProperty(ConfigDescriptor.prototype, 'extra', {
+  enumerable: true,
+  get: function () {
+    if (!this._interfaces) this._parse();
+    return this._extra;
+  }
+});
+
+ConfigDescriptor.prototype.toJSON = function () {
+  var out = toJSON.call(this);
+  out.interfaces = this.interfaces.map(function (alts) {
+    return alts.map(function (a) { return a.toJSON(); });
+  });
+  return out;
+};
+
+exports.ConfigDescriptor = ConfigDescriptor;
+exports.InterfaceDescriptor = InterfaceDescriptor;
+exports.EndpointDescriptor = EndpointDescriptor;
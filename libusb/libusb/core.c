@@ -1348,6 +1348,7 @@ static void do_close(struct libusb_context *ctx,
 		 * (or that such accesses will be easily caught and identified as a crash)
 		 */
 		usbi_mutex_lock(&itransfer->lock);
+		usbi_timeout_heap_remove(&ctx->timeout_heap, &itransfer->timeout_node);
 		list_del(&itransfer->list);
 		transfer->dev_handle = NULL;
 		usbi_mutex_unlock(&itransfer->lock);
@@ -36,6 +36,13 @@
 #ifdef USBI_TIMERFD_AVAILABLE
 #include <sys/timerfd.h>
 #endif
+#ifdef USBI_EPOLL_AVAILABLE
+#include <sys/epoll.h>
+
+/* most ready fds taken from the kernel per epoll_wait(); any others are
+ * reported by the next call, as epoll is used level-triggered */
+#define USBI_EPOLL_MAX_EVENTS	64
+#endif
 
 #include "libusbi.h"
 #include "hotplug.h"
@@ -1131,10 +1138,31 @@ int usbi_io_init(struct libusb_context *ctx)
 	usbi_mutex_init(&ctx->event_data_lock, NULL);
 	usbi_tls_key_create(&ctx->event_handling_key, NULL);
 	list_init(&ctx->flying_transfers);
+	usbi_timeout_heap_init(&ctx->timeout_heap);
 	list_init(&ctx->ipollfds);
 	list_init(&ctx->hotplug_msgs);
 	list_init(&ctx->completed_transfers);
 
+#ifdef USBI_EPOLL_AVAILABLE
+	/* set up before any poll fd is added, so that all of them are
+	 * registered with it */
+	ctx->epollfd = epoll_create1(EPOLL_CLOEXEC);
+	ctx->epoll_events = malloc(USBI_EPOLL_MAX_EVENTS * sizeof(*ctx->epoll_events));
+	ctx->epoll_ready = malloc((USBI_EPOLL_MAX_EVENTS + 2) * sizeof(*ctx->epoll_ready));
+	if (ctx->epollfd < 0 || !ctx->epoll_events || !ctx->epoll_ready) {
+		usbi_dbg("epoll not available (code %d error %d), using poll", ctx->epollfd, errno);
+		if (ctx->epollfd >= 0)
+			close(ctx->epollfd);
+		ctx->epollfd = -1;
+		free(ctx->epoll_events);
+		ctx->epoll_events = NULL;
+		free(ctx->epoll_ready);
+		ctx->epoll_ready = NULL;
+	} else {
+		usbi_dbg("using epoll for events");
+	}
+#endif
+
 	/* FIXME should use an eventfd on kernels that support it */
 	r = usbi_pipe(ctx->event_pipe);
 	if (r < 0) {
@@ -1171,6 +1199,12 @@ err_close_pipe:
 	usbi_close(ctx->event_pipe[0]);
 	usbi_close(ctx->event_pipe[1]);
 err:
+#ifdef USBI_EPOLL_AVAILABLE
+	if (usbi_using_epoll(ctx))
+		close(ctx->epollfd);
+	free(ctx->epoll_events);
+	free(ctx->epoll_ready);
+#endif
 	usbi_mutex_destroy(&ctx->flying_transfers_lock);
 	usbi_mutex_destroy(&ctx->events_lock);
 	usbi_mutex_destroy(&ctx->event_waiters_lock);
@@ -1191,6 +1225,13 @@ void usbi_io_exit(struct libusb_context *ctx)
 		close(ctx->timerfd);
 	}
 #endif
+#ifdef USBI_EPOLL_AVAILABLE
+	if (usbi_using_epoll(ctx))
+		close(ctx->epollfd);
+	free(ctx->epoll_events);
+	free(ctx->epoll_ready);
+#endif
+	usbi_timeout_heap_destroy(&ctx->timeout_heap);
 	usbi_mutex_destroy(&ctx->flying_transfers_lock);
 	usbi_mutex_destroy(&ctx->events_lock);
 	usbi_mutex_destroy(&ctx->event_waiters_lock);
@@ -1308,6 +1349,26 @@ void API_EXPORTED libusb_free_transfer(struct libusb_transfer *transfer)
 	free(itransfer);
 }
 
+/* returns the in-flight transfer with the earliest timeout that still needs
+ * to be handled by libusb, or NULL if there is none. Transfers whose timeout
+ * has already been handled, or is handled by the OS, are dropped from the
+ * timeout heap on the way.
+ * must be called with flying_list locked. */
+static struct usbi_transfer *next_timeout_transfer(struct libusb_context *ctx)
+{
+	struct usbi_timeout_node *node;
+
+	while ((node = usbi_timeout_heap_top(&ctx->timeout_heap))) {
+		struct usbi_transfer *transfer =
+			container_of(node, struct usbi_transfer, timeout_node);
+
+		if (!(transfer->flags & (USBI_TRANSFER_TIMEOUT_HANDLED | USBI_TRANSFER_OS_HANDLES_TIMEOUT)))
+			return transfer;
+		usbi_timeout_heap_remove(&ctx->timeout_heap, node);
+	}
+	return NULL;
+}
+
 #ifdef USBI_TIMERFD_AVAILABLE
 static int disarm_timerfd(struct libusb_context *ctx)
 {
@@ -1322,38 +1383,25 @@ static int disarm_timerfd(struct libusb_context *ctx)
 		return 0;
 }
 
-/* iterates through the flying transfers, and rearms the timerfd based on the
- * next upcoming timeout.
+/* rearms the timerfd based on the next upcoming timeout.
  * must be called with flying_list locked.
  * returns 0 on success or a LIBUSB_ERROR code on failure.
  */
 static int arm_timerfd_for_next_timeout(struct libusb_context *ctx)
 {
-	struct usbi_transfer *transfer;
+	struct usbi_transfer *transfer = next_timeout_transfer(ctx);
+	struct itimerspec it = { {0, 0}, {0, 0} };
 
-	list_for_each_entry(transfer, &ctx->flying_transfers, list, struct usbi_transfer) {
-		struct timeval *cur_tv = &transfer->timeout;
-
-		/* if we've reached transfers of infinite timeout, then we have no
-		 * arming to do */
-		if (!timerisset(cur_tv))
-			goto disarm;
-
-		/* act on first transfer that is not already cancelled */
-		if (!(transfer->flags & USBI_TRANSFER_TIMEOUT_HANDLED)) {
-			int r;
-			const struct itimerspec it = { {0, 0},
-				{ cur_tv->tv_sec, cur_tv->tv_usec * 1000 } };
-			usbi_dbg("next timeout originally %dms", USBI_TRANSFER_TO_LIBUSB_TRANSFER(transfer)->timeout);
-			r = timerfd_settime(ctx->timerfd, TFD_TIMER_ABSTIME, &it, NULL);
-			if (r < 0)
-				return LIBUSB_ERROR_OTHER;
-			return 0;
-		}
-	}
+	/* no transfer with a pending timeout, so no arming to do */
+	if (!transfer)
+		return disarm_timerfd(ctx);
 
-disarm:
-	return disarm_timerfd(ctx);
+	it.it_value.tv_sec = transfer->timeout.tv_sec;
+	it.it_value.tv_nsec = transfer->timeout.tv_usec * 1000;
+	usbi_dbg("next timeout originally %dms", USBI_TRANSFER_TO_LIBUSB_TRANSFER(transfer)->timeout);
+	if (timerfd_settime(ctx->timerfd, TFD_TIMER_ABSTIME, &it, NULL) < 0)
+		return LIBUSB_ERROR_OTHER;
+	return 0;
 }
 #else
 static int arm_timerfd_for_next_timeout(struct libusb_context *ctx)
@@ -1363,52 +1411,32 @@ static int arm_timerfd_for_next_timeout(struct libusb_context *ctx)
 }
 #endif
 
-/* add a transfer to the (timeout-sorted) active transfers list.
+/* add a transfer to the active transfers list, and to the timeout heap if
+ * it has a finite timeout.
  * This function will return non 0 if fails to update the timer,
  * in which case the transfer is *not* on the flying_transfers list. */
 static int add_to_flying_list(struct usbi_transfer *transfer)
 {
-	struct usbi_transfer *cur;
 	struct timeval *timeout = &transfer->timeout;
 	struct libusb_context *ctx = ITRANSFER_CTX(transfer);
 	int r = 0;
-	int first = 1;
+	int first = 0;
 
 	usbi_mutex_lock(&ctx->flying_transfers_lock);
 
-	/* if we have no other flying transfers, start the list with this one */
-	if (list_empty(&ctx->flying_transfers)) {
-		list_add(&transfer->list, &ctx->flying_transfers);
-		goto out;
-	}
-
-	/* if we have infinite timeout, append to end of list */
-	if (!timerisset(timeout)) {
-		list_add_tail(&transfer->list, &ctx->flying_transfers);
-		/* first is irrelevant in this case */
-		goto out;
-	}
-
-	/* otherwise, find appropriate place in list */
-	list_for_each_entry(cur, &ctx->flying_transfers, list, struct usbi_transfer) {
-		/* find first timeout that occurs after the transfer in question */
-		struct timeval *cur_tv = &cur->timeout;
+	list_add_tail(&transfer->list, &ctx->flying_transfers);
 
-		if (!timerisset(cur_tv) || (cur_tv->tv_sec > timeout->tv_sec) ||
-				(cur_tv->tv_sec == timeout->tv_sec &&
-					cur_tv->tv_usec > timeout->tv_usec)) {
-			list_add_tail(&transfer->list, &cur->list);
+	if (timerisset(timeout)) {
+		transfer->timeout_node.deadline = timeout;
+		if (usbi_timeout_heap_push(&ctx->timeout_heap, &transfer->timeout_node) < 0) {
+			r = LIBUSB_ERROR_NO_MEM;
 			goto out;
 		}
-		first = 0;
+		first = usbi_timeout_heap_top(&ctx->timeout_heap) == &transfer->timeout_node;
 	}
-	/* first is 0 at this stage (list not empty) */
 
-	/* otherwise we need to be inserted at the end */
-	list_add_tail(&transfer->list, &ctx->flying_transfers);
-out:
 #ifdef USBI_TIMERFD_AVAILABLE
-	if (first && usbi_using_timerfd(ctx) && timerisset(timeout)) {
+	if (first && usbi_using_timerfd(ctx)) {
 		/* if this transfer has the lowest timeout of all active transfers,
 		 * rearm the timerfd with this transfer's timeout */
 		const struct itimerspec it = { {0, 0},
@@ -1425,8 +1453,11 @@ out:
 	UNUSED(first);
 #endif
 
-	if (r)
+out:
+	if (r) {
+		usbi_timeout_heap_remove(&ctx->timeout_heap, &transfer->timeout_node);
 		list_del(&transfer->list);
+	}
 
 	usbi_mutex_unlock(&ctx->flying_transfers_lock);
 	return r;
@@ -1443,8 +1474,8 @@ static int remove_from_flying_list(struct usbi_transfer *transfer)
 	int r = 0;
 
 	usbi_mutex_lock(&ctx->flying_transfers_lock);
-	rearm_timerfd = (timerisset(&transfer->timeout) &&
-		list_first_entry(&ctx->flying_transfers, struct usbi_transfer, list) == transfer);
+	rearm_timerfd = (usbi_timeout_heap_top(&ctx->timeout_heap) == &transfer->timeout_node);
+	usbi_timeout_heap_remove(&ctx->timeout_heap, &transfer->timeout_node);
 	list_del(&transfer->list);
 	if (usbi_using_timerfd(ctx) && rearm_timerfd)
 		r = arm_timerfd_for_next_timeout(ctx);
@@ -1856,6 +1887,30 @@ int API_EXPORTED libusb_event_handler_active(libusb_context *ctx)
 	return ctx->event_handler_active;
 }
 
+/** \ingroup poll
+ * Interrupt any active thread that is handling events. This is mainly useful
+ * for interrupting a dedicated event handling thread when an application
+ * wishes to call libusb_exit(), or otherwise stop that thread: the thread's
+ * current (or next) call to libusb_handle_events() or a variant returns
+ * without waiting for its timeout.
+ *
+ * \param ctx the context to operate on, or NULL for the default context
+ * \ref mtasync
+ */
+void API_EXPORTED libusb_interrupt_event_handler(libusb_context *ctx)
+{
+	int pending_events;
+	USBI_GET_CONTEXT(ctx);
+
+	usbi_dbg("");
+	usbi_mutex_lock(&ctx->event_data_lock);
+	pending_events = usbi_pending_events(ctx);
+	ctx->event_interrupt = 1;
+	if (!pending_events)
+		usbi_signal_event(ctx);
+	usbi_mutex_unlock(&ctx->event_data_lock);
+}
+
 /** \ingroup poll
  * Acquire the event waiters lock. This lock is designed to be obtained under
  * the situation where you want to be aware when events are completed, but
@@ -1968,7 +2023,7 @@ static int handle_timeouts_locked(struct libusb_context *ctx)
 	struct timeval systime;
 	struct usbi_transfer *transfer;
 
-	if (list_empty(&ctx->flying_transfers))
+	if (!usbi_timeout_heap_top(&ctx->timeout_heap))
 		return 0;
 
 	/* get current time */
@@ -1978,19 +2033,11 @@ static int handle_timeouts_locked(struct libusb_context *ctx)
 
 	TIMESPEC_TO_TIMEVAL(&systime, &systime_ts);
 
-	/* iterate through flying transfers list, finding all transfers that
-	 * have expired timeouts */
-	list_for_each_entry(transfer, &ctx->flying_transfers, list, struct usbi_transfer) {
+	/* take transfers off the heap in expiry order until we reach one that
+	 * has not expired yet */
+	while ((transfer = next_timeout_transfer(ctx))) {
 		struct timeval *cur_tv = &transfer->timeout;
 
-		/* if we've reached transfers of infinite timeout, we're all done */
-		if (!timerisset(cur_tv))
-			return 0;
-
-		/* ignore timeouts we've already handled */
-		if (transfer->flags & (USBI_TRANSFER_TIMEOUT_HANDLED | USBI_TRANSFER_OS_HANDLES_TIMEOUT))
-			continue;
-
 		/* if transfer has non-expired timeout, nothing more to do */
 		if ((cur_tv->tv_sec > systime.tv_sec) ||
 				(cur_tv->tv_sec == systime.tv_sec &&
@@ -1998,6 +2045,7 @@ static int handle_timeouts_locked(struct libusb_context *ctx)
 			return 0;
 
 		/* otherwise, we've got an expired timeout to handle */
+		usbi_timeout_heap_remove(&ctx->timeout_heap, &transfer->timeout_node);
 		handle_timeout(transfer);
 	}
 	return 0;
@@ -2034,6 +2082,59 @@ out:
 }
 #endif
 
+#ifdef USBI_EPOLL_AVAILABLE
+/* wait for events on the epoll set and lay the result out the way
+ * handle_events() expects it from poll(): the event pipe and timerfd first,
+ * whether ready or not, then only the device fds that are ready.
+ * returns the number of ready fds, or -1 with errno set. */
+static int epoll_wait_ready(struct libusb_context *ctx,
+	POLL_NFDS_TYPE internal_nfds, int timeout_ms,
+	struct pollfd **fds, POLL_NFDS_TYPE *nfds)
+{
+	struct pollfd *ready = ctx->epoll_ready;
+	POLL_NFDS_TYPE count = internal_nfds;
+	int n, i;
+
+	n = epoll_wait(ctx->epollfd, ctx->epoll_events, USBI_EPOLL_MAX_EVENTS, timeout_ms);
+	if (n < 0)
+		return n;
+
+	ready[0].fd = ctx->event_pipe[0];
+	ready[0].events = POLLIN;
+	ready[0].revents = 0;
+#ifdef USBI_TIMERFD_AVAILABLE
+	if (usbi_using_timerfd(ctx)) {
+		ready[1].fd = ctx->timerfd;
+		ready[1].events = POLLIN;
+		ready[1].revents = 0;
+	}
+#endif
+
+	for (i = 0; i < n; i++) {
+		int fd = ctx->epoll_events[i].data.fd;
+		short revents = (short)ctx->epoll_events[i].events;
+		struct pollfd *pfd;
+
+		if (fd == ctx->event_pipe[0])
+			pfd = &ready[0];
+#ifdef USBI_TIMERFD_AVAILABLE
+		else if (usbi_using_timerfd(ctx) && fd == ctx->timerfd)
+			pfd = &ready[1];
+#endif
+		else {
+			pfd = &ready[count++];
+			pfd->fd = fd;
+			pfd->events = revents;
+		}
+		pfd->revents = revents;
+	}
+
+	*fds = ready;
+	*nfds = count;
+	return n;
+}
+#endif
+
 /* do the actual event handling. assumes that no other thread is concurrently
  * doing the same thing. */
 static int handle_events(struct libusb_context *ctx, struct timeval *tv)
@@ -2046,6 +2147,7 @@ static int handle_events(struct libusb_context *ctx, struct timeval *tv)
 	int i = -1;
 	int timeout_ms;
 	int special_event;
+	int interrupted = 0;
 
 	/* prevent attempts to recursively handle events (e.g. calling into
 	 * libusb_handle_events() from within a hotplug or transfer callback) */
@@ -2068,9 +2170,10 @@ static int handle_events(struct libusb_context *ctx, struct timeval *tv)
 		internal_nfds = 1;
 
 	/* only reallocate the poll fds when the list of poll fds has been modified
-	 * since the last poll, otherwise reuse them to save the additional overhead */
+	 * since the last poll, otherwise reuse them to save the additional overhead.
+	 * with epoll the kernel keeps the fd set, so there is nothing to rebuild */
 	usbi_mutex_lock(&ctx->event_data_lock);
-	if (ctx->pollfds_modified) {
+	if (ctx->pollfds_modified && !usbi_using_epoll(ctx)) {
 		usbi_dbg("poll fds modified, reallocating");
 
 		if (ctx->pollfds) {
@@ -2115,9 +2218,18 @@ static int handle_events(struct libusb_context *ctx, struct timeval *tv)
 		timeout_ms++;
 
 redo_poll:
-	usbi_dbg("poll() %d fds with timeout in %dms", nfds, timeout_ms);
-	r = usbi_poll(fds, nfds, timeout_ms);
-	usbi_dbg("poll() returned %d", r);
+#ifdef USBI_EPOLL_AVAILABLE
+	if (usbi_using_epoll(ctx)) {
+		usbi_dbg("epoll_wait() %d fds with timeout in %dms", nfds, timeout_ms);
+		r = epoll_wait_ready(ctx, internal_nfds, timeout_ms, &fds, &nfds);
+		usbi_dbg("epoll_wait() returned %d", r);
+	} else
+#endif
+	{
+		usbi_dbg("poll() %d fds with timeout in %dms", nfds, timeout_ms);
+		r = usbi_poll(fds, nfds, timeout_ms);
+		usbi_dbg("poll() returned %d", r);
+	}
 	if (r == 0) {
 		r = handle_timeouts(ctx);
 		goto done;
@@ -2153,6 +2265,13 @@ redo_poll:
 		if (ctx->device_close)
 			usbi_dbg("someone is closing a device");
 
+		/* check if someone wants the event handler to return */
+		if (ctx->event_interrupt) {
+			usbi_dbg("someone interrupted the event handler");
+			ctx->event_interrupt = 0;
+			interrupted = 1;
+		}
+
 		/* check for any pending hotplug messages */
 		if (!list_empty(&ctx->hotplug_msgs)) {
 			usbi_dbg("hotplug message received");
@@ -2224,7 +2343,7 @@ redo_poll:
 		usbi_err(ctx, "backend handle_events failed with error %d", r);
 
 handled:
-	if (r == 0 && special_event) {
+	if (r == 0 && special_event && !interrupted) {
 		timeout_ms = 0;
 		goto redo_poll;
 	}
@@ -2440,6 +2559,70 @@ int API_EXPORTED libusb_handle_events_locked(libusb_context *ctx,
 	return handle_events(ctx, &poll_timeout);
 }
 
+/** \ingroup poll
+ * Handle the events of a single file descriptor that your main loop found
+ * ready, without polling the others. For a device's file descriptor this
+ * reaps only that device's completed transfers and runs their callbacks. The
+ * event pipe and timerfd carry context-wide events, so for those (and if the
+ * events lock is contended) this falls back to
+ * libusb_handle_events_timeout() with a zero timeout.
+ *
+ * This is meant for single-threaded applications that watch each libusb
+ * file descriptor separately in their own main loop (\ref pollmain). It
+ * must not be called while holding the events lock.
+ *
+ * \param ctx the context to operate on, or NULL for the default context
+ * \param fd a file descriptor from libusb_get_pollfds() or the added
+ * notifier that has become ready
+ * \returns 0 on success, or a LIBUSB_ERROR code on failure
+ * \ref mtasync
+ */
+int API_EXPORTED libusb_handle_events_fd(libusb_context *ctx, int fd)
+{
+	struct timeval zero_tv = { 0, 0 };
+	struct pollfd pollfd;
+	int r;
+
+	USBI_GET_CONTEXT(ctx);
+	if (fd == ctx->event_pipe[0])
+		return libusb_handle_events_timeout(ctx, &zero_tv);
+#ifdef USBI_TIMERFD_AVAILABLE
+	if (usbi_using_timerfd(ctx) && fd == ctx->timerfd)
+		return libusb_handle_events_timeout(ctx, &zero_tv);
+#endif
+
+	if (libusb_try_lock_events(ctx))
+		return libusb_handle_events_timeout(ctx, &zero_tv);
+
+	/* recursion from a transfer callback */
+	if (usbi_handling_events(ctx)) {
+		libusb_unlock_events(ctx);
+		return LIBUSB_ERROR_BUSY;
+	}
+	usbi_start_event_handling(ctx);
+
+	/* the backend needs the real revents, e.g. POLLERR when the device
+	 * is gone, which the main loop may not pass through */
+	pollfd.fd = fd;
+	pollfd.events = POLLIN | POLLOUT;
+	pollfd.revents = 0;
+	r = usbi_poll(&pollfd, 1, 0);
+	if (r == 1) {
+		r = usbi_backend->handle_events(ctx, &pollfd, 1, 1);
+		if (r)
+			usbi_err(ctx, "backend handle_events failed with error %d", r);
+	} else if (r == -1 && errno == EINTR) {
+		r = LIBUSB_ERROR_INTERRUPTED;
+	} else if (r < 0) {
+		usbi_err(ctx, "poll failed %d err=%d", r, errno);
+		r = LIBUSB_ERROR_IO;
+	}
+
+	usbi_end_event_handling(ctx);
+	libusb_unlock_events(ctx);
+	return r;
+}
+
 /** \ingroup poll
  * Determines whether your application must apply special timing considerations
  * when monitoring libusb's file descriptors.
@@ -2528,17 +2711,9 @@ int API_EXPORTED libusb_get_next_timeout(libusb_context *ctx,
 	}
 
 	/* find next transfer which hasn't already been processed as timed out */
-	list_for_each_entry(transfer, &ctx->flying_transfers, list, struct usbi_transfer) {
-		if (transfer->flags & (USBI_TRANSFER_TIMEOUT_HANDLED | USBI_TRANSFER_OS_HANDLES_TIMEOUT))
-			continue;
-
-		/* if we've reached transfers of infinte timeout, we're done looking */
-		if (!timerisset(&transfer->timeout))
-			break;
-
+	transfer = next_timeout_transfer(ctx);
+	if (transfer)
 		next_timeout = transfer->timeout;
-		break;
-	}
 	usbi_mutex_unlock(&ctx->flying_transfers_lock);
 
 	if (!timerisset(&next_timeout)) {
@@ -2624,9 +2799,27 @@ int usbi_add_pollfd(struct libusb_context *ctx, int fd, short events)
 	ipollfd->pollfd.fd = fd;
 	ipollfd->pollfd.events = events;
 	usbi_mutex_lock(&ctx->event_data_lock);
+#ifdef USBI_EPOLL_AVAILABLE
+	if (usbi_using_epoll(ctx)) {
+		/* poll and epoll event bits have the same values on Linux */
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = (uint32_t)events;
+		ev.data.fd = fd;
+		if (epoll_ctl(ctx->epollfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			usbi_err(ctx, "failed to add fd %d to epoll set, errno=%d", fd, errno);
+			usbi_mutex_unlock(&ctx->event_data_lock);
+			free(ipollfd);
+			return LIBUSB_ERROR_OTHER;
+		}
+	}
+#endif
 	list_add_tail(&ipollfd->list, &ctx->ipollfds);
 	ctx->pollfds_cnt++;
-	usbi_fd_notification(ctx);
+	/* an epoll set picks up the new fd without the event handler having
+	 * to wake up and rebuild its fd array */
+	if (!usbi_using_epoll(ctx))
+		usbi_fd_notification(ctx);
 	usbi_mutex_unlock(&ctx->event_data_lock);
 
 	if (ctx->fd_added_cb)
@@ -2656,6 +2849,11 @@ void usbi_remove_pollfd(struct libusb_context *ctx, int fd)
 
 	list_del(&ipollfd->list);
 	ctx->pollfds_cnt--;
+#ifdef USBI_EPOLL_AVAILABLE
+	if (usbi_using_epoll(ctx))
+		epoll_ctl(ctx->epollfd, EPOLL_CTL_DEL, fd, NULL);
+	else
+#endif
 	usbi_fd_notification(ctx);
 	usbi_mutex_unlock(&ctx->event_data_lock);
 	free(ipollfd);
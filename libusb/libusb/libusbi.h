@@ -38,6 +38,7 @@
 
 #include "libusb.h"
 #include "version.h"
+#include "timeout_heap.h"
 
 /* Inside the libusb code, mark all public functions as follows:
  *   return_type API_EXPORTED function_name(params) { ... }
@@ -261,11 +262,13 @@ struct libusb_context {
 	struct list_head hotplug_cbs;
 	usbi_mutex_t hotplug_cbs_lock;
 
-	/* this is a list of in-flight transfer handles, sorted by timeout
-	 * expiration. URBs to timeout the soonest are placed at the beginning of
-	 * the list, URBs that will time out later are placed after, and urbs with
-	 * infinite timeout are always placed at the very end. */
+	/* this is a list of in-flight transfer handles, in no particular order.
+	 * Those with a finite timeout that has not been handled yet are also
+	 * kept in timeout_heap, ordered by expiration, so that submitting,
+	 * completing and finding the next timeout don't scan the list. Both are
+	 * protected by flying_transfers_lock. */
 	struct list_head flying_transfers;
+	struct usbi_timeout_heap timeout_heap;
 	usbi_mutex_t flying_transfers_lock;
 
 	/* user callbacks for pollfd changes */
@@ -295,6 +298,10 @@ struct libusb_context {
 	 * in order to safely close a device. Protected by event_data_lock. */
 	unsigned int device_close;
 
+	/* Set by libusb_interrupt_event_handler() to make the current (or next)
+	 * event handling call return. Protected by event_data_lock. */
+	unsigned int event_interrupt;
+
 	/* list and count of poll fds and an array of poll fd structures that is
 	 * (re)allocated as necessary prior to polling, and a flag to indicate
 	 * when the list of poll fds has changed since the last poll.
@@ -316,6 +323,16 @@ struct libusb_context {
 	int timerfd;
 #endif
 
+#ifdef USBI_EPOLL_AVAILABLE
+	/* epoll instance holding every poll fd, so that waiting for events
+	 * doesn't scan all of them, plus buffers for the fds one epoll_wait()
+	 * reports ready. epollfd is -1 when epoll could not be set up, in which
+	 * case poll() is used as on other platforms. */
+	int epollfd;
+	struct epoll_event *epoll_events;
+	struct pollfd *epoll_ready;
+#endif
+
 	struct list_head list;
 };
 
@@ -331,7 +348,7 @@ struct libusb_context {
 
 /* Update the following macro if new event sources are added */
 #define usbi_pending_events(ctx) \
-	((ctx)->device_close || (ctx)->pollfds_modified \
+	((ctx)->device_close || (ctx)->event_interrupt || (ctx)->pollfds_modified \
 	 || !list_empty(&(ctx)->hotplug_msgs) || !list_empty(&(ctx)->completed_transfers))
 
 #ifdef USBI_TIMERFD_AVAILABLE
@@ -340,6 +357,12 @@ struct libusb_context {
 #define usbi_using_timerfd(ctx) (0)
 #endif
 
+#ifdef USBI_EPOLL_AVAILABLE
+#define usbi_using_epoll(ctx) ((ctx)->epollfd >= 0)
+#else
+#define usbi_using_epoll(ctx) (0)
+#endif
+
 struct libusb_device {
 	/* lock protects refcnt, everything else is finalized at initialization
 	 * time */
@@ -410,6 +433,7 @@ struct usbi_transfer {
 	struct list_head list;
 	struct list_head completed_list;
 	struct timeval timeout;
+	struct usbi_timeout_node timeout_node;
 	int transferred;
 	uint32_t stream_id;
 	uint8_t flags;
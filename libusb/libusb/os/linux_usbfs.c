@@ -125,6 +125,15 @@ static usbi_mutex_static_t linux_hotplug_startstop_lock = USBI_MUTEX_INITIALIZER
 /* Serialize scan-devices, event-thread, and poll */
 usbi_mutex_static_t linux_hotplug_lock = USBI_MUTEX_INITIALIZER;
 
+/* Open handles indexed by their usbfs fd, so that op_handle_events() finds
+ * the handle for a ready fd without walking ctx->open_devs. fds are unique
+ * within the process, so one table serves every context. The lock only
+ * covers the table; a handle can't be closed while events are handled for
+ * it, since libusb_close() takes the event lock. */
+static struct libusb_device_handle **fd_handles = NULL;
+static int fd_handles_size = 0;
+static usbi_mutex_static_t fd_handles_lock = USBI_MUTEX_INITIALIZER;
+
 static int linux_start_event_monitor(void);
 static int linux_stop_event_monitor(void);
 static int linux_scan_devices(struct libusb_context *ctx);
@@ -469,6 +478,12 @@ static void op_exit(void)
 	if (!--init_count) {
 		/* tear down event handler */
 		(void)linux_stop_event_monitor();
+
+		usbi_mutex_static_lock(&fd_handles_lock);
+		free(fd_handles);
+		fd_handles = NULL;
+		fd_handles_size = 0;
+		usbi_mutex_static_unlock(&fd_handles_lock);
 	}
 	usbi_mutex_static_unlock(&linux_hotplug_startstop_lock);
 }
@@ -1285,6 +1300,45 @@ static int linux_default_scan_devices (struct libusb_context *ctx)
 }
 #endif
 
+static int set_fd_handle(int fd, struct libusb_device_handle *handle)
+{
+	usbi_mutex_static_lock(&fd_handles_lock);
+	if (fd >= fd_handles_size) {
+		int size = fd_handles_size ? fd_handles_size : 64;
+		struct libusb_device_handle **handles;
+
+		if (!handle) {
+			usbi_mutex_static_unlock(&fd_handles_lock);
+			return 0;
+		}
+		while (size <= fd)
+			size *= 2;
+		handles = realloc(fd_handles, size * sizeof(*handles));
+		if (!handles) {
+			usbi_mutex_static_unlock(&fd_handles_lock);
+			return LIBUSB_ERROR_NO_MEM;
+		}
+		memset(handles + fd_handles_size, 0,
+			(size - fd_handles_size) * sizeof(*handles));
+		fd_handles = handles;
+		fd_handles_size = size;
+	}
+	fd_handles[fd] = handle;
+	usbi_mutex_static_unlock(&fd_handles_lock);
+	return 0;
+}
+
+static struct libusb_device_handle *get_fd_handle(int fd)
+{
+	struct libusb_device_handle *handle = NULL;
+
+	usbi_mutex_static_lock(&fd_handles_lock);
+	if (fd >= 0 && fd < fd_handles_size)
+		handle = fd_handles[fd];
+	usbi_mutex_static_unlock(&fd_handles_lock);
+	return handle;
+}
+
 static int op_open(struct libusb_device_handle *handle)
 {
 	struct linux_device_handle_priv *hpriv = _device_handle_priv(handle);
@@ -1319,9 +1373,17 @@ static int op_open(struct libusb_device_handle *handle)
 			hpriv->caps |= USBFS_CAP_BULK_CONTINUATION;
 	}
 
+	r = set_fd_handle(hpriv->fd, handle);
+	if (r < 0) {
+		close(hpriv->fd);
+		return r;
+	}
+
 	r = usbi_add_pollfd(HANDLE_CTX(handle), hpriv->fd, POLLOUT);
-	if (r < 0)
+	if (r < 0) {
+		set_fd_handle(hpriv->fd, NULL);
 		close(hpriv->fd);
+	}
 
 	return r;
 }
@@ -1332,6 +1394,7 @@ static void op_close(struct libusb_device_handle *dev_handle)
 	/* fd may have already been removed by POLLERR condition in op_handle_events() */
 	if (!hpriv->fd_removed)
 		usbi_remove_pollfd(HANDLE_CTX(dev_handle), hpriv->fd);
+	set_fd_handle(hpriv->fd, NULL);
 	close(hpriv->fd);
 }
 
@@ -2578,27 +2641,22 @@ static int op_handle_events(struct libusb_context *ctx,
 	int r;
 	unsigned int i = 0;
 
-	usbi_mutex_lock(&ctx->open_devs_lock);
 	for (i = 0; i < nfds && num_ready > 0; i++) {
 		struct pollfd *pollfd = &fds[i];
 		struct libusb_device_handle *handle;
-		struct linux_device_handle_priv *hpriv = NULL;
+		struct linux_device_handle_priv *hpriv;
 
 		if (!pollfd->revents)
 			continue;
 
 		num_ready--;
-		list_for_each_entry(handle, &ctx->open_devs, list, struct libusb_device_handle) {
-			hpriv = _device_handle_priv(handle);
-			if (hpriv->fd == pollfd->fd)
-				break;
-		}
-
-		if (!hpriv || hpriv->fd != pollfd->fd) {
+		handle = get_fd_handle(pollfd->fd);
+		if (!handle || HANDLE_CTX(handle) != ctx) {
 			usbi_err(ctx, "cannot find handle for fd %d",
 				 pollfd->fd);
 			continue;
 		}
+		hpriv = _device_handle_priv(handle);
 
 		if (pollfd->revents & POLLERR) {
 			/* remove the fd from the pollfd set so that it doesn't continuously
@@ -2627,13 +2685,10 @@ static int op_handle_events(struct libusb_context *ctx,
 		if (r == 1 || r == LIBUSB_ERROR_NO_DEVICE)
 			continue;
 		else if (r < 0)
-			goto out;
+			return r;
 	}
 
-	r = 0;
-out:
-	usbi_mutex_unlock(&ctx->open_devs_lock);
-	return r;
+	return 0;
 }
 
 static int op_clock_gettime(int clk_id, struct timespec *tp)
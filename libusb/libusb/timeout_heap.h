@@ -0,0 +1,153 @@
+/* -*- Mode: C; indent-tabs-mode:t ; c-basic-offset:8 -*- */
+/*
+ * Binary min-heap of transfer timeouts for libusb
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if !defined(USBI_TIMEOUT_HEAP_H)
+#define USBI_TIMEOUT_HEAP_H
+
+/* struct timeval must already be declared by the includer (libusbi.h). */
+#include <stdlib.h>
+
+/* A node is embedded in each object whose expiry is tracked. pos is the
+ * node's 1-based slot in the heap, so a zero-initialised node is "not
+ * queued". */
+struct usbi_timeout_node {
+	const struct timeval *deadline;
+	unsigned int pos;
+};
+
+/* Ordered by deadline, earliest at nodes[0]. Insert and remove are
+ * O(log n), finding the next expiry is O(1). Not thread safe: callers
+ * serialise access (libusb uses flying_transfers_lock). */
+struct usbi_timeout_heap {
+	struct usbi_timeout_node **nodes;
+	unsigned int len;
+	unsigned int cap;
+};
+
+static inline int usbi_timeout_before(const struct usbi_timeout_node *a,
+	const struct usbi_timeout_node *b)
+{
+	return a->deadline->tv_sec < b->deadline->tv_sec ||
+		(a->deadline->tv_sec == b->deadline->tv_sec &&
+			a->deadline->tv_usec < b->deadline->tv_usec);
+}
+
+static inline void usbi_timeout_heap_set(struct usbi_timeout_heap *heap,
+	unsigned int i, struct usbi_timeout_node *node)
+{
+	heap->nodes[i] = node;
+	node->pos = i + 1;
+}
+
+static inline void usbi_timeout_heap_sift_up(struct usbi_timeout_heap *heap,
+	unsigned int i)
+{
+	struct usbi_timeout_node *node = heap->nodes[i];
+
+	while (i > 0) {
+		unsigned int parent = (i - 1) / 2;
+		if (!usbi_timeout_before(node, heap->nodes[parent]))
+			break;
+		usbi_timeout_heap_set(heap, i, heap->nodes[parent]);
+		i = parent;
+	}
+	usbi_timeout_heap_set(heap, i, node);
+}
+
+static inline void usbi_timeout_heap_sift_down(struct usbi_timeout_heap *heap,
+	unsigned int i)
+{
+	struct usbi_timeout_node *node = heap->nodes[i];
+
+	for (;;) {
+		unsigned int child = 2 * i + 1;
+		if (child >= heap->len)
+			break;
+		if (child + 1 < heap->len &&
+				usbi_timeout_before(heap->nodes[child + 1], heap->nodes[child]))
+			child++;
+		if (!usbi_timeout_before(heap->nodes[child], node))
+			break;
+		usbi_timeout_heap_set(heap, i, heap->nodes[child]);
+		i = child;
+	}
+	usbi_timeout_heap_set(heap, i, node);
+}
+
+static inline void usbi_timeout_heap_init(struct usbi_timeout_heap *heap)
+{
+	heap->nodes = NULL;
+	heap->len = 0;
+	heap->cap = 0;
+}
+
+static inline void usbi_timeout_heap_destroy(struct usbi_timeout_heap *heap)
+{
+	free(heap->nodes);
+	usbi_timeout_heap_init(heap);
+}
+
+static inline struct usbi_timeout_node *usbi_timeout_heap_top(
+	struct usbi_timeout_heap *heap)
+{
+	return heap->len ? heap->nodes[0] : NULL;
+}
+
+/* returns 0 on success or -1 if the heap could not grow */
+static inline int usbi_timeout_heap_push(struct usbi_timeout_heap *heap,
+	struct usbi_timeout_node *node)
+{
+	if (heap->len == heap->cap) {
+		unsigned int cap = heap->cap ? 2 * heap->cap : 64;
+		struct usbi_timeout_node **nodes =
+			realloc(heap->nodes, cap * sizeof(*nodes));
+		if (!nodes)
+			return -1;
+		heap->nodes = nodes;
+		heap->cap = cap;
+	}
+
+	heap->nodes[heap->len] = node;
+	usbi_timeout_heap_sift_up(heap, heap->len++);
+	return 0;
+}
+
+/* remove a node from anywhere in the heap; a no-op if it isn't queued */
+static inline void usbi_timeout_heap_remove(struct usbi_timeout_heap *heap,
+	struct usbi_timeout_node *node)
+{
+	unsigned int i = node->pos - 1;
+	struct usbi_timeout_node *last;
+
+	if (!node->pos)
+		return;
+	node->pos = 0;
+
+	last = heap->nodes[--heap->len];
+	if (i == heap->len)
+		return;
+
+	heap->nodes[i] = last;
+	if (i > 0 && usbi_timeout_before(last, heap->nodes[(i - 1) / 2]))
+		usbi_timeout_heap_sift_up(heap, i);
+	else
+		usbi_timeout_heap_sift_down(heap, i);
+}
+
+#endif
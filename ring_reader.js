@@ -0,0 +1,119 @@
+// Consumer side of InEndpoint.startRing(). This file doesn't load the
+// native addon, so a worker thread can require it on its own and read a
+// ring whose SharedArrayBuffer was posted to it.
+//
+// Layout of the buffer, matching RingStream in src/node_usb.h: a header of
+// HEADER_WORDS 32-bit words, one Int32 length per slot, then the slots
+// themselves from the next 64-byte boundary. HEAD and TAIL count slots
+// published by the libusb event thread and released by the reader.
+
+var HEAD = 0;
+var TAIL = 1;
+var OVERRUNS = 2;
+var WAITING = 3;
+var STATE = 4;
+var SLOTS = 5;
+var SLOT_SIZE = 6;
+var ERROR = 7;
+var HEADER_WORDS = 8;
+
+function dataOffset(slots) {
+  return ((HEADER_WORDS + slots) * 4 + 63) & ~63;
+}
+
+// Node 8 only has the older name
+var notify = Atomics.notify || Atomics.wake;
+
+function RingReader(buffer) {
+  if (!(buffer instanceof SharedArrayBuffer)) {
+    throw new TypeError('Expected a SharedArrayBuffer');
+  }
+  var header = new Int32Array(buffer, 0, HEADER_WORDS);
+  var slots = header[SLOTS], slotSize = header[SLOT_SIZE];
+  if (!slots || !slotSize) {
+    throw new Error('SharedArrayBuffer does not hold a ring');
+  }
+
+  this.buffer = buffer;
+  this.header = header;
+  this.lengths = new Int32Array(buffer, HEADER_WORDS * 4, slots);
+  this.slots = slots;
+  this.slotSize = slotSize;
+
+  // Slot Buffers are made once; read() only slices them to length
+  var data = dataOffset(slots);
+  this.views = [];
+  for (var i = 0; i < slots; i++) {
+    this.views[i] = Buffer.from(buffer, data + i * slotSize, slotSize);
+  }
+
+  this.pos = Atomics.load(header, TAIL);
+  this.tail = this.pos;
+}
+
+RingReader.create = function (slots, slotSize) {
+  var buffer = new SharedArrayBuffer(dataOffset(slots) + slots * slotSize);
+  var header = new Int32Array(buffer, 0, HEADER_WORDS);
+  header[SLOTS] = slots;
+  header[SLOT_SIZE] = slotSize;
+  return buffer;
+};
+
+// Wake a reader blocked in read(). Called by the producer side.
+RingReader.wake = function (header) {
+  notify(header, HEAD);
+};
+
+// Next unread slot as a Buffer of the bytes received, which stays valid
+// until the slot is released. Blocks for up to `timeout` ms (forever if
+// undefined) and returns null on timeout, or once the ring has stopped and
+// everything in it has been read.
+RingReader.prototype.read = function (timeout) {
+  var header = this.header;
+  var deadline = timeout > 0 ? Date.now() + timeout : 0;
+
+  for (;;) {
+    // State before head: once stopped, the head read after it is final
+    var running = Atomics.load(header, STATE) !== 0;
+    var head = Atomics.load(header, HEAD);
+    if (head !== this.pos) {
+      var slot = this.pos & (this.slots - 1);
+      this.pos = (this.pos + 1) | 0;
+      return this.views[slot].slice(0, this.lengths[slot]);
+    }
+    if (!running || timeout === 0) return null;
+
+    var wait = timeout === undefined ? Infinity : deadline - Date.now();
+    if (wait <= 0) return null;
+
+    // The producer clears WAITING and wakes us when it next moves HEAD. If
+    // it moved in between, wait() returns at once as HEAD != head.
+    Atomics.store(header, WAITING, 1);
+    Atomics.wait(header, HEAD, head, wait);
+  }
+};
+
+// Hand the oldest slot returned by read() back to the producer
+RingReader.prototype.release = function () {
+  if (this.tail === this.pos) {
+    throw new Error('No slot to release');
+  }
+  this.tail = (this.tail + 1) | 0;
+  Atomics.store(this.header, TAIL, this.tail);
+};
+
+// Transfers whose data was dropped because the ring was full
+RingReader.prototype.overruns = function () {
+  return Atomics.load(this.header, OVERRUNS);
+};
+
+// libusb error that stopped the ring, or 0
+RingReader.prototype.error = function () {
+  return Atomics.load(this.header, ERROR);
+};
+
+RingReader.prototype.running = function () {
+  return Atomics.load(this.header, STATE) !== 0;
+};
+
+module.exports = RingReader;
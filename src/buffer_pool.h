@@ -0,0 +1,69 @@
+#ifndef SRC_BUFFER_POOL_H
+#define SRC_BUFFER_POOL_H
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <vector>
+
+// Free lists of native transfer buffers in power-of-two size classes, for
+// data that is assembled on the main thread (e.g. gathered writes) rather
+// than passed through from a JS Buffer. Buffers above the largest class are
+// allocated and freed directly. The free lists are per thread, so each
+// environment (main thread or worker) has its own.
+class BufferPool{
+	public:
+		enum {
+			MIN_SHIFT = 6,       // 64 bytes
+			MAX_SHIFT = 20,      // 1 MiB
+			MAX_FREE = 16        // buffers kept per class
+		};
+
+		// Returns a buffer of at least `size` bytes and stores its real
+		// size in `capacity`, which must be passed back to release().
+		static unsigned char* acquire(size_t size, size_t& capacity){
+			int shift = classOf(size);
+			if (shift > MAX_SHIFT) {
+				capacity = size;
+				return (unsigned char*) malloc(size ? size : 1);
+			}
+
+			capacity = (size_t) 1 << shift;
+			std::vector<unsigned char*>& list = freeList(shift);
+			if (!list.empty()) {
+				unsigned char* data = list.back();
+				list.pop_back();
+				return data;
+			}
+			return (unsigned char*) malloc(capacity);
+		}
+
+		static void release(unsigned char* data, size_t capacity){
+			if (!data) return;
+			int shift = classOf(capacity);
+			if (shift > MAX_SHIFT || ((size_t) 1 << shift) != capacity) {
+				free(data);
+				return;
+			}
+
+			std::vector<unsigned char*>& list = freeList(shift);
+			if (list.size() < MAX_FREE) {
+				list.push_back(data);
+			} else {
+				free(data);
+			}
+		}
+
+	private:
+		static int classOf(size_t size){
+			int shift = MIN_SHIFT;
+			while (((size_t) 1 << shift) < size && shift <= MAX_SHIFT) shift++;
+			return shift;
+		}
+
+		static std::vector<unsigned char*>& freeList(int shift){
+			static thread_local std::vector<unsigned char*> lists[MAX_SHIFT - MIN_SHIFT + 1];
+			return lists[shift - MIN_SHIFT];
+		}
+};
+
+#endif
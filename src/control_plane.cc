@@ -0,0 +1,153 @@
+#include "node_usb.h"
+
+// Device management calls (reset, set configuration, set interface,
+// release interface) block in usbfs ioctls for as long as the device takes,
+// so they get threads of their own rather than the libuv threadpool, where
+// they would hold up file I/O, DNS and crypto.
+//
+// Each physical device has a lane of pending calls. A lane is on the run
+// queue at most once, so a device's calls run one at a time and in order,
+// while calls for different devices run in parallel on up to `threads`
+// threads. Like the event threads, the executor belongs to the process.
+
+#define CONTROL_PLANE_DEFAULT_THREADS 4
+
+struct ControlPlaneLane {
+	std::deque<ControlPlaneOp*> ops;
+};
+
+static uv_mutex_t lock;
+static uv_cond_t wakeup;
+static std::map<libusb_device*, ControlPlaneLane*> lanes;
+static std::deque<ControlPlaneLane*> runnable;
+static std::vector<uv_thread_t> threads;
+static int wantThreads = CONTROL_PLANE_DEFAULT_THREADS;
+
+// Stats, guarded by lock
+static int queued, running, maxQueued;
+static double completed;
+
+static void controlPlaneThread(void*){
+	uv_mutex_lock(&lock);
+	for (;;) {
+		while (runnable.empty()) {
+			uv_cond_wait(&wakeup, &lock);
+		}
+		ControlPlaneLane* lane = runnable.front();
+		runnable.pop_front();
+		ControlPlaneOp* op = lane->ops.front();
+		queued--;
+		running++;
+		uv_mutex_unlock(&lock);
+
+		op->work(op->req);
+
+		uv_mutex_lock(&lock);
+		running--;
+		completed++;
+		lane->ops.pop_front();
+		if (lane->ops.empty()) {
+			lanes.erase(op->device);
+			delete lane;
+		} else {
+			runnable.push_back(lane);
+			uv_cond_signal(&wakeup);
+		}
+		uv_mutex_unlock(&lock);
+
+		// The queue's reference keeps the environment's state alive
+		op->env->controlPlaneQueue.post(op);
+		uv_mutex_lock(&lock);
+	}
+}
+
+// Called with lock held
+static int startThreads(){
+	while ((int) threads.size() < wantThreads) {
+		uv_thread_t thread;
+		if (uv_thread_create(&thread, controlPlaneThread, NULL) != 0) {
+			return threads.empty() ? LIBUSB_ERROR_OTHER : LIBUSB_SUCCESS;
+		}
+		threads.push_back(thread);
+	}
+	return LIBUSB_SUCCESS;
+}
+
+int controlPlaneSubmit(ControlPlaneOp* op){
+	uv_mutex_lock(&lock);
+	int r = startThreads();
+	if (r == LIBUSB_SUCCESS) {
+		ControlPlaneLane*& lane = lanes[op->device];
+		bool idle = lane == NULL;
+		if (idle) lane = new ControlPlaneLane();
+		lane->ops.push_back(op);
+		queued++;
+		if (queued > maxQueued) maxQueued = queued;
+		if (idle) {
+			runnable.push_back(lane);
+			uv_cond_signal(&wakeup);
+		}
+		op->env->controlPlaneQueue.ref();
+	}
+	uv_mutex_unlock(&lock);
+	return r;
+}
+
+// Threads actually running, which can be fewer than asked for if creating
+// one failed
+int controlPlaneThreads(){
+	uv_mutex_lock(&lock);
+	int n = (int) threads.size();
+	uv_mutex_unlock(&lock);
+	return n;
+}
+
+void handleControlPlaneDone(ControlPlaneOp* op){
+	op->env->controlPlaneQueue.unref();
+	op->after(op->req, 0);
+}
+
+// setControlPlaneThreads(n): run device management calls for up to n
+// devices at once. Threads can be added but not removed.
+NAN_METHOD(SetControlPlaneThreads) {
+	Nan::HandleScope scope;
+	if (info.Length() != 1 || !info[0]->IsUint32() || info[0]->Uint32Value() < 1) {
+		THROW_BAD_ARGS("Usb::SetControlPlaneThreads argument is invalid. [uint:>=1]!")
+	}
+	uv_mutex_lock(&lock);
+	if ((int) info[0]->Uint32Value() > wantThreads) {
+		wantThreads = (int) info[0]->Uint32Value();
+	}
+	int r = threads.empty() ? LIBUSB_SUCCESS : startThreads();
+	uv_mutex_unlock(&lock);
+	CHECK_USB(r);
+	info.GetReturnValue().Set(Nan::Undefined());
+}
+
+// getControlPlaneStats(): queue depth and throughput of the executor
+NAN_METHOD(GetControlPlaneStats) {
+	Nan::HandleScope scope;
+	Local<Object> stats = Nan::New<Object>();
+
+	uv_mutex_lock(&lock);
+	stats->Set(V8STR("threads"), Nan::New<Uint32>((uint32_t) threads.size()));
+	stats->Set(V8STR("wantThreads"), Nan::New<Uint32>((uint32_t) wantThreads));
+	stats->Set(V8STR("queued"), Nan::New<Uint32>((uint32_t) queued));
+	stats->Set(V8STR("maxQueued"), Nan::New<Uint32>((uint32_t) maxQueued));
+	stats->Set(V8STR("running"), Nan::New<Uint32>((uint32_t) running));
+	stats->Set(V8STR("devices"), Nan::New<Uint32>((uint32_t) lanes.size()));
+	stats->Set(V8STR("completed"), Nan::New<Number>(completed));
+	uv_mutex_unlock(&lock);
+
+	info.GetReturnValue().Set(stats);
+}
+
+void ControlPlane::Start(){
+	uv_mutex_init(&lock);
+	uv_cond_init(&wakeup);
+}
+
+void ControlPlane::Init(Local<Object> target){
+	Nan::SetMethod(target, "setControlPlaneThreads", SetControlPlaneThreads);
+	Nan::SetMethod(target, "getControlPlaneStats", GetControlPlaneStats);
+}
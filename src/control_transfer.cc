@@ -0,0 +1,153 @@
+#include "node_usb.h"
+#include "buffer_pool.h"
+#include <string.h>
+
+extern "C" void LIBUSB_CALL controlCompletionCb(libusb_transfer *transfer);
+
+// Requests are recycled along with their libusb_transfer and buffer, so a
+// steady stream of control transfers doesn't allocate. Kept per thread, as
+// each environment (main thread or worker) runs on its own.
+#define MAX_IDLE_CONTROL_REQUESTS 64
+static thread_local std::vector<ControlRequest*> idleControlRequests;
+
+static ControlRequest* takeControlRequest(size_t length){
+	ControlRequest* req;
+	if (!idleControlRequests.empty()) {
+		req = idleControlRequests.back();
+		idleControlRequests.pop_back();
+	} else {
+		req = new ControlRequest;
+		req->transfer = libusb_alloc_transfer(0);
+		req->transfer->user_data = req;
+		req->data = NULL;
+		req->capacity = 0;
+	}
+
+	if (req->capacity < length) {
+		BufferPool::release(req->data, req->capacity);
+		req->data = BufferPool::acquire(length, req->capacity);
+	}
+	return req;
+}
+
+static void recycleControlRequest(ControlRequest* req){
+	req->device = NULL;
+	req->v8callback.Reset();
+	if (idleControlRequests.size() < MAX_IDLE_CONTROL_REQUESTS) {
+		idleControlRequests.push_back(req);
+		return;
+	}
+	BufferPool::release(req->data, req->capacity);
+	libusb_free_transfer(req->transfer);
+	delete req;
+}
+
+// Device.__controlTransfer(bmRequestType, bRequest, wValue, wIndex, data_or_length, timeout, [callback])
+NAN_METHOD(Device_ControlTransfer) {
+	ENTER_METHOD(Device, 6);
+	int bmRequestType, bRequest, wValue, wIndex, timeout;
+	INT_ARG(bmRequestType, 0);
+	INT_ARG(bRequest, 1);
+	INT_ARG(wValue, 2);
+	INT_ARG(wIndex, 3);
+	INT_ARG(timeout, 5);
+
+	bool isIn = !!(bmRequestType & LIBUSB_ENDPOINT_IN);
+	int wLength;
+	if (isIn) {
+		INT_ARG(wLength, 4);
+	} else {
+		if (!Buffer::HasInstance(info[4])){
+			THROW_BAD_ARGS("Buffer arg [4] must be Buffer for OUT transfers");
+		}
+		wLength = (int) Buffer::Length(info[4]);
+	}
+	if (wLength < 0 || wLength > 0xffff){
+		THROW_BAD_ARGS("Invalid data length");
+	}
+
+	Local<Function> callback;
+	if (info.Length() > 6 && info[6]->IsFunction()) {
+		callback = Local<Function>::Cast(info[6]);
+	}
+
+	if (!self->device_handle){
+		THROW_ERROR("Device is not open");
+	}
+
+	ControlRequest* req = takeControlRequest(LIBUSB_CONTROL_SETUP_SIZE + wLength);
+	req->device = self;
+	libusb_fill_control_setup(req->data, bmRequestType, bRequest, wValue, wIndex, wLength);
+	if (!isIn && wLength > 0) {
+		memcpy(req->data + LIBUSB_CONTROL_SETUP_SIZE, Buffer::Data(info[4]), wLength);
+	}
+	libusb_fill_control_transfer(req->transfer, self->device_handle, req->data,
+		controlCompletionCb, req, timeout);
+	if (!callback.IsEmpty()) {
+		req->v8callback.Reset(callback);
+	}
+
+	int r = libusb_submit_transfer(req->transfer);
+	if (r < 0) {
+		recycleControlRequest(req);
+		return Nan::ThrowError(libusbException(r));
+	}
+
+	self->ref();
+	#ifndef USE_POLL
+	self->env->controlQueue.ref();
+	#endif
+
+	info.GetReturnValue().Set(info.This());
+}
+
+extern "C" void LIBUSB_CALL controlCompletionCb(libusb_transfer *transfer){
+	ControlRequest* req = static_cast<ControlRequest*>(transfer->user_data);
+	DEBUG_LOG("Control completion %p", req);
+
+	#ifdef USE_POLL
+	handleControlCompletion(req);
+	#else
+	req->device->env->controlQueue.post(req);
+	#endif
+}
+
+void handleControlCompletion(ControlRequest* req){
+	Nan::HandleScope scope;
+	Device* device = req->device;
+	libusb_transfer* t = req->transfer;
+
+	#ifndef USE_POLL
+	device->env->controlQueue.unref();
+	#endif
+
+	if (!req->v8callback.IsEmpty()) {
+		Local<Function> callback = Nan::New(req->v8callback);
+		Local<Value> error = Nan::Undefined();
+		if (t->status != LIBUSB_TRANSFER_COMPLETED){
+			error = libusbException(t->status);
+		}
+
+		// IN data is copied straight out of the pooled buffer, at its
+		// actual length, so the request can be reused right away
+		Local<Value> data = Nan::Undefined();
+		if (req->data[0] & LIBUSB_ENDPOINT_IN) {
+			data = Nan::CopyBuffer((char*) libusb_control_transfer_get_data(t),
+				t->actual_length).ToLocalChecked();
+		}
+
+		// Recycle first: the callback may well issue the next request
+		recycleControlRequest(req);
+
+		Local<Value> argv[] = {error, data};
+		Nan::TryCatch try_catch;
+		Nan::MakeCallback(device->handle(), callback, 2, argv);
+		if (try_catch.HasCaught()) {
+			Nan::FatalException(try_catch);
+		}
+	} else {
+		recycleControlRequest(req);
+	}
+
+	device->unref();
+}
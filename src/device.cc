@@ -2,20 +2,14 @@
 #include <string.h>
 
 #define STRUCT_TO_V8(TARGET, STR, NAME) \
-		TARGET->ForceSet(V8STR(#NAME), Nan::New<Uint32>((uint32_t) (STR).NAME), CONST_PROP);
+		Nan::DefineOwnProperty(TARGET, V8STR(#NAME), Nan::New<Uint32>((uint32_t) (STR).NAME), CONST_PROP);
 
 #define CHECK_OPEN() \
 		if (!self->device_handle){THROW_ERROR("Device is not opened");}
 
 #define MAX_PORTS 7
 
-static Nan::Persistent<v8::FunctionTemplate> device_constructor;
-
-Local<Object> makeBuffer(const unsigned char* ptr, unsigned length) {
-	return Nan::NewBuffer((char*) ptr, (uint32_t) length).ToLocalChecked();
-}
-
-Device::Device(libusb_device* d): device(d), device_handle(0) {
+Device::Device(libusb_device* d): device(d), device_handle(0), env(UsbEnv::current()) {
 	libusb_ref_device(device);
 	DEBUG_LOG("Created device %p", this);
 }
@@ -25,40 +19,50 @@ Device::~Device(){
 	DEBUG_LOG("Freed device %p", this);
 	libusb_close(device_handle);
 	libusb_unref_device(device);
+	v8descriptor.Reset();
+	v8ports.Reset();
+	v8configs.Reset();
 }
 
-// Map each libusb_device to a particular V8 instance
-StdPersistentValueMap<libusb_device*, v8::Object> Device::byPtr(Isolate::GetCurrent());
-
-// Get a V8 instance for a libusb_device: either the existing one from the map,
-// or create a new one and add it to the map.
+// Get a V8 instance for a libusb_device: either the existing one from the
+// environment's map, or create a new one and add it to the map.
 Local<Object> Device::get(libusb_device* dev){
-	Local<Object> it = byPtr.Get(dev);
+	UsbEnv* env = UsbEnv::current();
+	Local<Object> it = env->devices.Get(dev);
 	if (!it.IsEmpty()) {
 		return it;
 	} else {
-		Local<FunctionTemplate> constructorHandle = Nan::New<v8::FunctionTemplate>(device_constructor);
+		Local<FunctionTemplate> constructorHandle = Nan::New<v8::FunctionTemplate>(env->deviceConstructor);
 		Local<Value> argv[1] = { EXTERNAL_NEW(new Device(dev)) };
 		Local<Object> obj = constructorHandle->GetFunction()->NewInstance(1, argv);
-		byPtr.Set(dev, obj);
+		env->devices.Set(dev, obj);
 		return obj;
 	}
 }
 
 static NAN_METHOD(deviceConstructor) {
 	ENTER_CONSTRUCTOR_POINTER(Device, 1);
+	info.GetReturnValue().Set(info.This());
+}
 
-	info.This()->ForceSet(V8SYM("busNumber"),
-		Nan::New<Uint32>((uint32_t) libusb_get_bus_number(self->device)), CONST_PROP);
-	info.This()->ForceSet(V8SYM("deviceAddress"),
-		Nan::New<Uint32>((uint32_t) libusb_get_device_address(self->device)), CONST_PROP);
-
-	Local<Object> v8dd = Nan::New<Object>();
-	info.This()->ForceSet(V8SYM("deviceDescriptor"), v8dd, CONST_PROP);
+// Device properties are accessors on the instance template, so creating a
+// Device (for every entry of getDeviceList() and every hotplug event) only
+// wraps the libusb_device. The descriptor object and port array are built
+// the first time they are read and the same objects returned after that.
+NAN_GETTER(Device_BusNumber) {
+	ENTER_ACCESSOR(Device);
+	info.GetReturnValue().Set(Nan::New<Uint32>((uint32_t) libusb_get_bus_number(self->device)));
+}
 
-	struct libusb_device_descriptor dd;
-	CHECK_USB(libusb_get_device_descriptor(self->device, &dd));
+NAN_GETTER(Device_DeviceAddress) {
+	ENTER_ACCESSOR(Device);
+	info.GetReturnValue().Set(Nan::New<Uint32>((uint32_t) libusb_get_device_address(self->device)));
+}
 
+// Always the same fields in the same order, so every descriptor object
+// shares one hidden class
+Local<Object> deviceDescriptorObject(const libusb_device_descriptor& dd){
+	Local<Object> v8dd = Nan::New<Object>();
 	STRUCT_TO_V8(v8dd, dd, bLength)
 	STRUCT_TO_V8(v8dd, dd, bDescriptorType)
 	STRUCT_TO_V8(v8dd, dd, bcdUSB)
@@ -73,98 +77,224 @@ static NAN_METHOD(deviceConstructor) {
 	STRUCT_TO_V8(v8dd, dd, iProduct)
 	STRUCT_TO_V8(v8dd, dd, iSerialNumber)
 	STRUCT_TO_V8(v8dd, dd, bNumConfigurations)
+	return v8dd;
+}
 
-	uint8_t port_numbers[MAX_PORTS];
-	int ret = libusb_get_port_numbers(self->device, &port_numbers[0], MAX_PORTS);
-	CHECK_USB(ret);
-	Local<Array> array = Nan::New<Array>(ret);
-	for (int i = 0; i < ret; ++ i) {
-		array->Set(i, Nan::New(port_numbers[i]));
+NAN_GETTER(Device_DeviceDescriptor) {
+	ENTER_ACCESSOR(Device);
+	if (self->v8descriptor.IsEmpty()) {
+		struct libusb_device_descriptor dd;
+		CHECK_USB(libusb_get_device_descriptor(self->device, &dd));
+		self->v8descriptor.Reset(deviceDescriptorObject(dd));
+	}
+	info.GetReturnValue().Set(Nan::New(self->v8descriptor));
+}
+
+NAN_GETTER(Device_PortNumbers) {
+	ENTER_ACCESSOR(Device);
+	if (self->v8ports.IsEmpty()) {
+		uint8_t port_numbers[MAX_PORTS];
+		int ret = libusb_get_port_numbers(self->device, &port_numbers[0], MAX_PORTS);
+		CHECK_USB(ret);
+		Local<Array> array = Nan::New<Array>(ret);
+		for (int i = 0; i < ret; ++ i) {
+			array->Set(i, Nan::New(port_numbers[i]));
+		}
+		self->v8ports.Reset(array);
 	}
+	info.GetReturnValue().Set(Nan::New(self->v8ports));
+}
 
-	info.This()->ForceSet(V8SYM("portNumbers"), array, CONST_PROP);
+static void appendBytes(std::vector<unsigned char>& out, const unsigned char* p, int n){
+	out.insert(out.end(), p, p + n);
+}
 
-	info.GetReturnValue().Set(info.This());
+// Write a parsed descriptor as exactly its bLength (p[0]) bytes, so walking
+// the blob by bLength stays in step. Fields past the ones libusb parses
+// weren't kept; they are written as zeros.
+static void appendDescriptor(std::vector<unsigned char>& out, const unsigned char* p, int n){
+	int length = p[0];
+	appendBytes(out, p, length < n ? length : n);
+	if (length > n) out.insert(out.end(), length - n, 0);
 }
 
-NAN_METHOD(Device_GetConfigDescriptor) {
+// Reassemble the descriptors of a configuration as the device sent them.
+// libusb keeps every descriptor it doesn't parse in the `extra` of the one
+// before it, so writing each parsed descriptor followed by its extra bytes
+// restores the original order.
+void serializeConfig(const libusb_config_descriptor* cdesc, std::vector<unsigned char>& out){
+	unsigned char c[9] = {cdesc->bLength, cdesc->bDescriptorType, 0, 0, cdesc->bNumInterfaces,
+		cdesc->bConfigurationValue, cdesc->iConfiguration, cdesc->bmAttributes, cdesc->MaxPower};
+	appendDescriptor(out, c, sizeof(c));
+	appendBytes(out, cdesc->extra, cdesc->extra_length);
+
+	for (int i = 0; i < cdesc->bNumInterfaces; i++) {
+		for (int a = 0; a < cdesc->interface[i].num_altsetting; a++) {
+			const libusb_interface_descriptor& idesc = cdesc->interface[i].altsetting[a];
+			unsigned char d[9] = {idesc.bLength, idesc.bDescriptorType, idesc.bInterfaceNumber,
+				idesc.bAlternateSetting, idesc.bNumEndpoints, idesc.bInterfaceClass,
+				idesc.bInterfaceSubClass, idesc.bInterfaceProtocol, idesc.iInterface};
+			appendDescriptor(out, d, sizeof(d));
+			appendBytes(out, idesc.extra, idesc.extra_length);
+
+			for (int e = 0; e < idesc.bNumEndpoints; e++) {
+				const libusb_endpoint_descriptor& edesc = idesc.endpoint[e];
+				// Audio class endpoints have two more fields, written only if
+				// bLength has room for them
+				unsigned char ep[9] = {edesc.bLength, edesc.bDescriptorType, edesc.bEndpointAddress,
+					edesc.bmAttributes, (unsigned char) (edesc.wMaxPacketSize & 0xff),
+					(unsigned char) (edesc.wMaxPacketSize >> 8), edesc.bInterval, edesc.bRefresh,
+					edesc.bSynchAddress};
+				appendDescriptor(out, ep, sizeof(ep));
+				appendBytes(out, edesc.extra, edesc.extra_length);
+			}
+		}
+	}
+
+	// wTotalLength of what the blob actually holds
+	out[2] = (unsigned char) (out.size() & 0xff);
+	out[3] = (unsigned char) (out.size() >> 8);
+}
+
+// Device.__getConfigBlob([bConfigurationValue]): raw descriptors of a
+// configuration, the active one by default. Each configuration is read from
+// libusb once per device and the same Buffer returned after that; callers
+// must not modify it.
+NAN_METHOD(Device_GetConfigBlob) {
 	ENTER_METHOD(Device, 0);
 
-	libusb_config_descriptor* cdesc;
-	CHECK_USB(libusb_get_active_config_descriptor(self->device, &cdesc));
-
-	Local<Object> v8cdesc = Nan::New<Object>();
-
-	STRUCT_TO_V8(v8cdesc, *cdesc, bLength)
-	STRUCT_TO_V8(v8cdesc, *cdesc, bDescriptorType)
-	STRUCT_TO_V8(v8cdesc, *cdesc, wTotalLength)
-	STRUCT_TO_V8(v8cdesc, *cdesc, bNumInterfaces)
-	STRUCT_TO_V8(v8cdesc, *cdesc, bConfigurationValue)
-	STRUCT_TO_V8(v8cdesc, *cdesc, iConfiguration)
-	STRUCT_TO_V8(v8cdesc, *cdesc, bmAttributes)
-	// Libusb 1.0 typo'd bMaxPower as MaxPower
-	v8cdesc->ForceSet(V8STR("bMaxPower"), Nan::New<Uint32>((uint32_t) cdesc->MaxPower), CONST_PROP);
-
-	v8cdesc->ForceSet(V8SYM("extra"), makeBuffer(cdesc->extra, cdesc->extra_length), CONST_PROP);
-
-	Local<Array> v8interfaces = Nan::New<Array>(cdesc->bNumInterfaces);
-	v8cdesc->ForceSet(V8SYM("interfaces"), v8interfaces);
-
-	for (int idxInterface = 0; idxInterface < cdesc->bNumInterfaces; idxInterface++) {
-		int numAltSettings = cdesc->interface[idxInterface].num_altsetting;
-
-		Local<Array> v8altsettings = Nan::New<Array>(numAltSettings);
-		v8interfaces->Set(idxInterface, v8altsettings);
-
-		for (int idxAltSetting = 0; idxAltSetting < numAltSettings; idxAltSetting++) {
-			const libusb_interface_descriptor& idesc =
-				cdesc->interface[idxInterface].altsetting[idxAltSetting];
-
-			Local<Object> v8idesc = Nan::New<Object>();
-			v8altsettings->Set(idxAltSetting, v8idesc);
-
-			STRUCT_TO_V8(v8idesc, idesc, bLength)
-			STRUCT_TO_V8(v8idesc, idesc, bDescriptorType)
-			STRUCT_TO_V8(v8idesc, idesc, bInterfaceNumber)
-			STRUCT_TO_V8(v8idesc, idesc, bAlternateSetting)
-			STRUCT_TO_V8(v8idesc, idesc, bNumEndpoints)
-			STRUCT_TO_V8(v8idesc, idesc, bInterfaceClass)
-			STRUCT_TO_V8(v8idesc, idesc, bInterfaceSubClass)
-			STRUCT_TO_V8(v8idesc, idesc, bInterfaceProtocol)
-			STRUCT_TO_V8(v8idesc, idesc, iInterface)
-
-			v8idesc->ForceSet(V8SYM("extra"), makeBuffer(idesc.extra, idesc.extra_length), CONST_PROP);
-
-			Local<Array> v8endpoints = Nan::New<Array>(idesc.bNumEndpoints);
-			v8idesc->ForceSet(V8SYM("endpoints"), v8endpoints, CONST_PROP);
-			for (int idxEndpoint = 0; idxEndpoint < idesc.bNumEndpoints; idxEndpoint++){
-				const libusb_endpoint_descriptor& edesc = idesc.endpoint[idxEndpoint];
-
-				Local<Object> v8edesc = Nan::New<Object>();
-				v8endpoints->Set(idxEndpoint, v8edesc);
-
-				STRUCT_TO_V8(v8edesc, edesc, bLength)
-				STRUCT_TO_V8(v8edesc, edesc, bDescriptorType)
-				STRUCT_TO_V8(v8edesc, edesc, bEndpointAddress)
-				STRUCT_TO_V8(v8edesc, edesc, bmAttributes)
-				STRUCT_TO_V8(v8edesc, edesc, wMaxPacketSize)
-				STRUCT_TO_V8(v8edesc, edesc, bInterval)
-				STRUCT_TO_V8(v8edesc, edesc, bRefresh)
-				STRUCT_TO_V8(v8edesc, edesc, bSynchAddress)
-
-				v8edesc->ForceSet(V8SYM("extra"), makeBuffer(edesc.extra, edesc.extra_length), CONST_PROP);
+	int value = -1;
+	if (info.Length() > 0 && !info[0]->IsUndefined()) {
+		INT_ARG(value, 0);
+	}
+
+	libusb_config_descriptor* cdesc = NULL;
+	if (value < 0) {
+		if (self->device_handle) {
+			// Cheap on an open device, where libusb asks the OS directly
+			CHECK_USB(libusb_get_configuration(self->device_handle, &value));
+			if (value == 0) {
+				CHECK_USB(LIBUSB_ERROR_NOT_FOUND);
 			}
+		} else {
+			CHECK_USB(libusb_get_active_config_descriptor(self->device, &cdesc));
+			value = cdesc->bConfigurationValue;
 		}
 	}
 
+	if (self->v8configs.IsEmpty()) {
+		self->v8configs.Reset(Nan::New<Object>());
+	}
+	Local<Object> configs = Nan::New(self->v8configs);
+	Local<Value> cached = configs->Get(value);
+	if (node::Buffer::HasInstance(cached)) {
+		if (cdesc) libusb_free_config_descriptor(cdesc);
+		info.GetReturnValue().Set(cached);
+		return;
+	}
+
+	if (!cdesc) {
+		CHECK_USB(libusb_get_config_descriptor_by_value(self->device, (uint8_t) value, &cdesc));
+	}
+	std::vector<unsigned char> blob;
+	serializeConfig(cdesc, blob);
 	libusb_free_config_descriptor(cdesc);
-	info.GetReturnValue().Set(v8cdesc);
+
+	Local<Object> buf = Nan::CopyBuffer((const char*) &blob[0], (uint32_t) blob.size()).ToLocalChecked();
+	configs->Set(value, buf);
+	info.GetReturnValue().Set(buf);
+}
+
+static Local<Array> langidArray(const std::vector<uint16_t>& langids){
+	Local<Array> arr = Nan::New<Array>((int) langids.size());
+	for (size_t i = 0; i < langids.size(); i++) {
+		arr->Set(i, Nan::New<Uint32>((uint32_t) langids[i]));
+	}
+	return arr;
+}
+
+// Device.__getCachedString(index, langid): string descriptor from the
+// registry's cache, the array of langids for index 0, or undefined if it
+// hasn't been read
+NAN_METHOD(Device_GetCachedString) {
+	ENTER_METHOD(Device, 2);
+	int index, langid;
+	INT_ARG(index, 0);
+	INT_ARG(langid, 1);
+
+	if (index == 0) {
+		std::vector<uint16_t> langids;
+		if (Registry::getLangids(self->device, langids)) {
+			info.GetReturnValue().Set(langidArray(langids));
+		}
+	} else {
+		std::string str;
+		if (Registry::getString(self->device, (uint8_t) index, (uint16_t) langid, str)) {
+			info.GetReturnValue().Set(Nan::New<String>(str).ToLocalChecked());
+		}
+	}
 }
 
+// Device.__cacheStringDescriptor(index, langid, data): decode a string
+// descriptor read from the device and cache it. Returns what
+// __getCachedString() will, or undefined if data isn't a string descriptor.
+NAN_METHOD(Device_CacheStringDescriptor) {
+	ENTER_METHOD(Device, 3);
+	int index, langid;
+	INT_ARG(index, 0);
+	INT_ARG(langid, 1);
+	if (!Buffer::HasInstance(info[2])) {
+		THROW_BAD_ARGS("Arg [2] must be a Buffer");
+	}
+	const unsigned char* desc = (const unsigned char*) Buffer::Data(info[2]);
+	int length = (int) Buffer::Length(info[2]);
+
+	if (index == 0) {
+		std::vector<uint16_t> langids;
+		if (Registry::putLangids(self->device, desc, length, langids)) {
+			info.GetReturnValue().Set(langidArray(langids));
+		}
+	} else {
+		std::string str;
+		if (Registry::putStringDescriptor(self->device, (uint8_t) index, (uint16_t) langid, desc, length, str)) {
+			info.GetReturnValue().Set(Nan::New<String>(str).ToLocalChecked());
+		}
+	}
+}
+
+// Device.__open([eventThread])
 NAN_METHOD(Device_Open) {
 	ENTER_METHOD(Device, 0);
+	int eventThread = 0;
+	if (info.Length() > 0 && !info[0]->IsUndefined()) {
+		INT_ARG(eventThread, 0);
+	}
 	if (!self->device_handle){
-		CHECK_USB(libusb_open(self->device, &self->device_handle));
+		if (eventThread == 0) {
+			CHECK_USB(libusb_open(self->device, &self->device_handle));
+		} else {
+			// Open the same device through the other thread's context, so that
+			// its events are handled there. The handle keeps that context's
+			// libusb_device alive.
+			libusb_context* ctx = eventThreadContext(eventThread);
+			if (!ctx) {
+				THROW_BAD_ARGS("No such event thread");
+			}
+			libusb_device **devs;
+			int cnt = libusb_get_device_list(ctx, &devs);
+			CHECK_USB(cnt);
+			int r = LIBUSB_ERROR_NO_DEVICE;
+			uint8_t bus = libusb_get_bus_number(self->device);
+			uint8_t address = libusb_get_device_address(self->device);
+			for (int i = 0; i < cnt; i++) {
+				if (libusb_get_bus_number(devs[i]) == bus && libusb_get_device_address(devs[i]) == address) {
+					r = libusb_open(devs[i], &self->device_handle);
+					break;
+				}
+			}
+			libusb_free_device_list(devs, true);
+			CHECK_USB(r);
+		}
 	}
 	info.GetReturnValue().Set(Nan::Undefined());
 }
@@ -180,24 +310,34 @@ NAN_METHOD(Device_Close) {
 	info.GetReturnValue().Set(Nan::Undefined());
 }
 
+// Blocking device management call, run on the control-plane executor
+// (see control_plane.cc) rather than the libuv threadpool
 struct Req{
 	uv_work_t req;
+	ControlPlaneOp op;
 	Device* device;
 	Nan::Persistent<Function> callback;
 	int errcode;
 
-	void submit(Device* d, Local<Function> cb, uv_work_cb backend, uv_work_cb after){
+	int submit(Device* d, Local<Function> cb, uv_work_cb backend, uv_work_cb after){
 		callback.Reset(cb);
 		device = d;
-		device->ref();
 		req.data = this;
-		uv_queue_work(uv_default_loop(), &req, backend, (uv_after_work_cb) after);
+		op.req = &req;
+		op.work = backend;
+		op.after = (uv_after_work_cb) after;
+		op.device = d->device;
+		op.env = d->env;
+		int r = controlPlaneSubmit(&op);
+		if (r == LIBUSB_SUCCESS) {
+			device->ref();
+		}
+		return r;
 	}
 
 	static void default_after(uv_work_t *req){
-		Nan::HandleScope scope;
 		auto baton = (Req*) req->data;
-
+		Nan::HandleScope scope;
 		auto device = baton->device->handle();
 		baton->device->unref();
 
@@ -224,7 +364,11 @@ struct Device_Reset: Req{
 		CHECK_OPEN();
 		CALLBACK_ARG(0);
 		auto baton = new Device_Reset;
-		baton->submit(self, callback, &backend, &default_after);
+		int r = baton->submit(self, callback, &backend, &default_after);
+		if (r < 0) {
+			delete baton;
+			CHECK_USB(r);
+		}
 		info.GetReturnValue().Set(Nan::Undefined());
 	}
 
@@ -282,7 +426,11 @@ struct Device_ReleaseInterface: Req{
 		CALLBACK_ARG(1);
 		auto baton = new Device_ReleaseInterface;
 		baton->interface = interface;
-		baton->submit(self, callback, &backend, &default_after);
+		int r = baton->submit(self, callback, &backend, &default_after);
+		if (r < 0) {
+			delete baton;
+			CHECK_USB(r);
+		}
 
 		info.GetReturnValue().Set(Nan::Undefined());
 	}
@@ -307,7 +455,11 @@ struct Device_SetInterface: Req{
 		auto baton = new Device_SetInterface;
 		baton->interface = interface;
 		baton->altsetting = altsetting;
-		baton->submit(self, callback, &backend, &default_after);
+		int r = baton->submit(self, callback, &backend, &default_after);
+		if (r < 0) {
+			delete baton;
+			CHECK_USB(r);
+		}
 		info.GetReturnValue().Set(Nan::Undefined());
 	}
 
@@ -329,7 +481,11 @@ struct Device_SetConfiguration: Req{
 		CALLBACK_ARG(1);
 		auto baton = new Device_SetConfiguration;
 		baton->desired = desired;
-		baton->submit(self, callback, &backend, &default_after);
+		int r = baton->submit(self, callback, &backend, &default_after);
+		if (r < 0) {
+			delete baton;
+			CHECK_USB(r);
+		}
 		info.GetReturnValue().Set(Nan::Undefined());
 	}
 
@@ -346,6 +502,52 @@ NAN_METHOD(Device_GetSpeed) {
 	info.GetReturnValue().Set(Nan::New(r));
 }
 
+// Collect endpoint addresses from a JS array for the bulk stream calls
+static bool endpointList(Local<Value> arg, std::vector<unsigned char>& endpoints) {
+	if (!arg->IsArray()) return false;
+	Local<Array> arr = Local<Array>::Cast(arg);
+	for (uint32_t i = 0; i < arr->Length(); i++) {
+		Local<Value> v = arr->Get(i);
+		if (!v->IsNumber()) return false;
+		endpoints.push_back((unsigned char) v->Uint32Value());
+	}
+	return endpoints.size() > 0;
+}
+
+NAN_METHOD(Device_AllocStreams) {
+	ENTER_METHOD(Device, 2);
+	CHECK_OPEN();
+	int numStreams;
+	INT_ARG(numStreams, 0);
+	std::vector<unsigned char> endpoints;
+	if (!endpointList(info[1], endpoints)) {
+		THROW_BAD_ARGS("Parameter endpoints (1) should be a non-empty array of endpoint addresses");
+	}
+	int r = libusb_alloc_streams(self->device_handle, numStreams, &endpoints[0], (int) endpoints.size());
+	CHECK_USB(r);
+	info.GetReturnValue().Set(Nan::New(r));
+}
+
+NAN_METHOD(Device_FreeStreams) {
+	ENTER_METHOD(Device, 1);
+	CHECK_OPEN();
+	std::vector<unsigned char> endpoints;
+	if (!endpointList(info[0], endpoints)) {
+		THROW_BAD_ARGS("Parameter endpoints (0) should be a non-empty array of endpoint addresses");
+	}
+	CHECK_USB(libusb_free_streams(self->device_handle, &endpoints[0], (int) endpoints.size()));
+	info.GetReturnValue().Set(Nan::Undefined());
+}
+
+NAN_METHOD(Device_GetMaxIsoPacketSize) {
+	ENTER_METHOD(Device, 1);
+	int endpoint;
+	INT_ARG(endpoint, 0);
+	int r = libusb_get_max_iso_packet_size(self->device, endpoint);
+	CHECK_USB(r);
+	info.GetReturnValue().Set(Nan::New(r));
+}
+
 NAN_METHOD(Device_SetAutoDetachKernelDrive) {
 	ENTER_METHOD(Device, 1);
 	// should check ?
@@ -363,7 +565,13 @@ void Device::Init(Local<Object> target){
 	tpl->SetClassName(Nan::New("Device").ToLocalChecked());
 	tpl->InstanceTemplate()->SetInternalFieldCount(1);
 
-	Nan::SetPrototypeMethod(tpl, "__getConfigDescriptor", Device_GetConfigDescriptor);
+	Local<ObjectTemplate> itpl = tpl->InstanceTemplate();
+	Nan::SetAccessor(itpl, V8SYM("busNumber"), Device_BusNumber, 0, Local<Value>(), DEFAULT, CONST_PROP);
+	Nan::SetAccessor(itpl, V8SYM("deviceAddress"), Device_DeviceAddress, 0, Local<Value>(), DEFAULT, CONST_PROP);
+	Nan::SetAccessor(itpl, V8SYM("deviceDescriptor"), Device_DeviceDescriptor, 0, Local<Value>(), DEFAULT, CONST_PROP);
+	Nan::SetAccessor(itpl, V8SYM("portNumbers"), Device_PortNumbers, 0, Local<Value>(), DEFAULT, CONST_PROP);
+
+	Nan::SetPrototypeMethod(tpl, "__getConfigBlob", Device_GetConfigBlob);
 	Nan::SetPrototypeMethod(tpl, "__open", Device_Open);
 	Nan::SetPrototypeMethod(tpl, "__close", Device_Close);
 	Nan::SetPrototypeMethod(tpl, "reset", Device_Reset::begin);
@@ -377,9 +585,15 @@ void Device::Init(Local<Object> target){
 	Nan::SetPrototypeMethod(tpl, "__detachKernelDriver", DetachKernelDriver);
 	Nan::SetPrototypeMethod(tpl, "__attachKernelDriver", AttachKernelDriver);
 
+	Nan::SetPrototypeMethod(tpl, "__controlTransfer", Device_ControlTransfer);
+	Nan::SetPrototypeMethod(tpl, "__getCachedString", Device_GetCachedString);
+	Nan::SetPrototypeMethod(tpl, "__cacheStringDescriptor", Device_CacheStringDescriptor);
 	Nan::SetPrototypeMethod(tpl, "__getSpeed", Device_GetSpeed);
+	Nan::SetPrototypeMethod(tpl, "__getMaxIsoPacketSize", Device_GetMaxIsoPacketSize);
+	Nan::SetPrototypeMethod(tpl, "__allocStreams", Device_AllocStreams);
+	Nan::SetPrototypeMethod(tpl, "__freeStreams", Device_FreeStreams);
 	Nan::SetPrototypeMethod(tpl, "__setAutoDetachKernelDrive", Device_SetAutoDetachKernelDrive);
 
-	device_constructor.Reset(tpl);
+	UsbEnv::current()->deviceConstructor.Reset(tpl);
 	target->Set(Nan::New("Device").ToLocalChecked(), tpl->GetFunction());
 }
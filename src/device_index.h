@@ -0,0 +1,169 @@
+#ifndef SRC_DEVICE_INDEX_H
+#define SRC_DEVICE_INDEX_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+
+// What the device registry knows about an attached device, all of it from
+// descriptors libusb already holds in memory. The serial number needs a
+// string descriptor read, so it is filled in the first time it is asked for.
+struct DeviceInfo {
+	void* device;
+	uint16_t idVendor;
+	uint16_t idProduct;
+	uint8_t iSerialNumber;
+	// Bus and port numbers as in sysfs, e.g. "1-2.4"
+	std::string path;
+	// Device class followed by the classes of the interfaces of the first
+	// configuration
+	std::vector<uint8_t> classes;
+	std::string serial;
+	bool serialKnown;
+	// String descriptors read so far, UTF-8, by langid << 8 | index. Index
+	// 0, the device's language list, is kept in langids instead.
+	std::map<uint32_t, std::string> strings;
+	std::vector<uint16_t> langids;
+	bool langidsKnown;
+	// Order of arrival, so lookups list devices in the order they came
+	uint64_t seq;
+
+	DeviceInfo(): device(NULL), idVendor(0), idProduct(0), iSerialNumber(0),
+		serialKnown(false), langidsKnown(false), seq(0) {}
+};
+
+// Attached devices indexed by every key they can be looked up by. `device`
+// is opaque here (a libusb_device* in the registry). Not thread-safe; the
+// registry guards it with its own lock.
+class DeviceIndex{
+	public:
+		typedef std::vector<DeviceInfo*> List;
+
+		DeviceIndex(): nextSeq(0) {}
+
+		~DeviceIndex(){
+			for (auto it = byDevice.begin(); it != byDevice.end(); ++it) {
+				delete it->second;
+			}
+		}
+
+		// Takes ownership of info. Returns false if the device is known.
+		bool add(DeviceInfo* info){
+			if (byDevice.count(info->device)) return false;
+			info->seq = nextSeq++;
+			byDevice[info->device] = info;
+			byIds[idsKey(info->idVendor, info->idProduct)][info->seq] = info;
+			byPath[info->path] = info;
+			for (size_t i = 0; i < info->classes.size(); i++) {
+				byClass[info->classes[i]][info->seq] = info;
+			}
+			if (info->serialKnown) {
+				bySerial[info->serial][info->seq] = info;
+			}
+			return true;
+		}
+
+		// Gives up ownership of the entry for device, NULL if there is none
+		DeviceInfo* remove(void* device){
+			auto it = byDevice.find(device);
+			if (it == byDevice.end()) return NULL;
+			DeviceInfo* info = it->second;
+			byDevice.erase(it);
+			erase(byIds, idsKey(info->idVendor, info->idProduct), info);
+			auto path = byPath.find(info->path);
+			if (path != byPath.end() && path->second == info) byPath.erase(path);
+			for (size_t i = 0; i < info->classes.size(); i++) {
+				erase(byClass, info->classes[i], info);
+			}
+			if (info->serialKnown) {
+				erase(bySerial, info->serial, info);
+			}
+			return info;
+		}
+
+		DeviceInfo* get(void* device){
+			auto it = byDevice.find(device);
+			return it == byDevice.end() ? NULL : it->second;
+		}
+
+		void setSerial(DeviceInfo* info, const std::string& serial){
+			if (info->serialKnown) {
+				erase(bySerial, info->serial, info);
+			}
+			info->serial = serial;
+			info->serialKnown = true;
+			bySerial[serial][info->seq] = info;
+		}
+
+		// Each find appends up to `limit` matches, oldest first
+		void findByIds(uint16_t idVendor, uint16_t idProduct, List& out, size_t limit = (size_t) -1){
+			collect(byIds, idsKey(idVendor, idProduct), out, limit);
+		}
+
+		void findBySerial(const std::string& serial, List& out, size_t limit = (size_t) -1){
+			collect(bySerial, serial, out, limit);
+		}
+
+		void findByClass(uint8_t cls, List& out, size_t limit = (size_t) -1){
+			collect(byClass, cls, out, limit);
+		}
+
+		DeviceInfo* findByPath(const std::string& path){
+			auto it = byPath.find(path);
+			return it == byPath.end() ? NULL : it->second;
+		}
+
+		// Entries whose serial number hasn't been read yet
+		void unknownSerials(List& out){
+			for (auto it = byDevice.begin(); it != byDevice.end(); ++it) {
+				if (!it->second->serialKnown) out.push_back(it->second);
+			}
+		}
+
+		void all(List& out){
+			for (auto it = byDevice.begin(); it != byDevice.end(); ++it) {
+				out.push_back(it->second);
+			}
+		}
+
+		size_t size(){
+			return byDevice.size();
+		}
+
+	private:
+		// Devices sharing a key, by arrival. Removing one is logarithmic in
+		// the number sharing it, however many identical devices a fleet has.
+		typedef std::map<uint64_t, DeviceInfo*> Bucket;
+
+		uint64_t nextSeq;
+		std::unordered_map<void*, DeviceInfo*> byDevice;
+		std::unordered_map<uint32_t, Bucket> byIds;
+		std::unordered_map<std::string, Bucket> bySerial;
+		std::unordered_map<std::string, DeviceInfo*> byPath;
+		std::unordered_map<int, Bucket> byClass;
+
+		static uint32_t idsKey(uint16_t idVendor, uint16_t idProduct){
+			return ((uint32_t) idVendor << 16) | idProduct;
+		}
+
+		template <class M, class K>
+		static void erase(M& map, const K& key, DeviceInfo* info){
+			auto it = map.find(key);
+			if (it == map.end()) return;
+			it->second.erase(info->seq);
+			if (it->second.empty()) map.erase(it);
+		}
+
+		template <class M, class K>
+		static void collect(M& map, const K& key, List& out, size_t limit){
+			auto it = map.find(key);
+			if (it == map.end()) return;
+			for (auto d = it->second.begin(); d != it->second.end() && limit > 0; ++d, --limit) {
+				out.push_back(d->second);
+			}
+		}
+};
+
+#endif
@@ -0,0 +1,298 @@
+#include "node_usb.h"
+
+// Inventory of the whole bus without blocking the JS thread. The scan and
+// each matching device's reads run as control-plane calls, so they stay in
+// order with resets and configuration changes of the same device, and up
+// to `concurrency` devices are read at a time. Strings go through the
+// registry's cache, shared with Device.getStringDescriptor().
+
+extern libusb_context* usb_context;
+
+#define MAX_PORTS 7
+#define US_ENGLISH 0x0409
+
+struct EnumerateJob;
+
+// One matching device, filled in on a control-plane thread
+struct EnumerateEntry {
+	uv_work_t req;
+	ControlPlaneOp op;
+	EnumerateJob* job;
+	libusb_device* device;
+	libusb_device_descriptor dd;
+	std::vector<uint8_t> ports;
+	int speed;
+	// Empty if the active configuration couldn't be read
+	std::vector<unsigned char> config;
+	std::map<uint8_t, std::string> strings;
+	// First failure opening the device or reading its strings
+	int stringError;
+
+	EnumerateEntry(): job(NULL), device(NULL), speed(0), stringError(0) {}
+};
+
+struct EnumerateJob {
+	uv_work_t req;
+	ControlPlaneOp op;
+	UsbEnv* env;
+	int idVendor, idProduct;
+	bool strings;
+	int concurrency;
+	int errcode;
+	std::vector<EnumerateEntry*> entries;
+	size_t submitted, done;
+	Nan::Persistent<Function> callback;
+
+	EnumerateJob(): env(NULL), idVendor(-1), idProduct(-1), strings(false), concurrency(1),
+		errcode(0), submitted(0), done(0) {}
+
+	~EnumerateJob(){
+		for (size_t i = 0; i < entries.size(); i++) {
+			libusb_unref_device(entries[i]->device);
+			delete entries[i];
+		}
+		callback.Reset();
+	}
+};
+
+static void scanWork(uv_work_t* req){
+	auto job = (EnumerateJob*) req->data;
+	libusb_device** devs;
+	int cnt = libusb_get_device_list(usb_context, &devs);
+	if (cnt < 0) {
+		job->errcode = cnt;
+		return;
+	}
+	for (int i = 0; i < cnt; i++) {
+		libusb_device_descriptor dd;
+		if (libusb_get_device_descriptor(devs[i], &dd) < 0) continue;
+		if (job->idVendor >= 0 && dd.idVendor != job->idVendor) continue;
+		if (job->idProduct >= 0 && dd.idProduct != job->idProduct) continue;
+		auto e = new EnumerateEntry();
+		e->job = job;
+		e->device = libusb_ref_device(devs[i]);
+		e->dd = dd;
+		job->entries.push_back(e);
+	}
+	libusb_free_device_list(devs, true);
+}
+
+// The strings of the device descriptor, in the first language the device
+// lists as getStringDescriptor() does. The device is only opened if some
+// aren't cached.
+static void readStrings(EnumerateEntry* e){
+	uint8_t indexes[] = {e->dd.iManufacturer, e->dd.iProduct, e->dd.iSerialNumber};
+	libusb_device_handle* handle = NULL;
+	unsigned char buf[255];
+	std::vector<uint16_t> langids;
+	bool langidsKnown = Registry::getLangids(e->device, langids);
+
+	for (size_t i = 0; i < sizeof(indexes); i++) {
+		uint8_t index = indexes[i];
+		if (!index || e->strings.count(index)) continue;
+
+		if (!handle) {
+			// Only open if one of them isn't cached
+			std::string cached;
+			if (langidsKnown && Registry::getString(e->device, index,
+					langids.empty() ? US_ENGLISH : langids[0], cached)) {
+				e->strings[index] = cached;
+				continue;
+			}
+			int r = libusb_open(e->device, &handle);
+			if (r < 0) {
+				e->stringError = r;
+				return;
+			}
+		}
+
+		if (!langidsKnown) {
+			// Devices that don't list languages are usually English only
+			int r = libusb_get_string_descriptor(handle, 0, 0, buf, sizeof(buf));
+			if (r < 0 || !Registry::putLangids(e->device, buf, r, langids)) {
+				langids.clear();
+			}
+			langidsKnown = true;
+		}
+		uint16_t langid = langids.empty() ? US_ENGLISH : langids[0];
+
+		std::string str;
+		if (!Registry::getString(e->device, index, langid, str)) {
+			int r = libusb_get_string_descriptor(handle, index, langid, buf, sizeof(buf));
+			if (r < 0 || !Registry::putStringDescriptor(e->device, index, langid, buf, r, str)) {
+				if (!e->stringError) e->stringError = r < 0 ? r : LIBUSB_ERROR_IO;
+				continue;
+			}
+		}
+		e->strings[index] = str;
+	}
+
+	if (handle) libusb_close(handle);
+}
+
+static void entryWork(uv_work_t* req){
+	auto e = (EnumerateEntry*) req->data;
+
+	uint8_t ports[MAX_PORTS];
+	int n = libusb_get_port_numbers(e->device, ports, MAX_PORTS);
+	if (n > 0) e->ports.assign(ports, ports + n);
+	e->speed = libusb_get_device_speed(e->device);
+
+	libusb_config_descriptor* cdesc;
+	if (libusb_get_active_config_descriptor(e->device, &cdesc) == LIBUSB_SUCCESS) {
+		serializeConfig(cdesc, e->config);
+		libusb_free_config_descriptor(cdesc);
+	}
+
+	if (e->job->strings) {
+		readStrings(e);
+	}
+}
+
+static void setString(Local<Object> obj, const char* name, EnumerateEntry* e, uint8_t index){
+	auto it = e->strings.find(index);
+	if (index && it != e->strings.end()) {
+		obj->Set(V8STR(name), Nan::New<String>(it->second).ToLocalChecked());
+	}
+}
+
+static Local<Object> entryObject(EnumerateEntry* e){
+	Local<Object> obj = Nan::New<Object>();
+	obj->Set(V8STR("device"), Device::get(e->device));
+	obj->Set(V8STR("busNumber"), Nan::New<Uint32>((uint32_t) libusb_get_bus_number(e->device)));
+	obj->Set(V8STR("deviceAddress"), Nan::New<Uint32>((uint32_t) libusb_get_device_address(e->device)));
+	Local<Array> ports = Nan::New<Array>((int) e->ports.size());
+	for (size_t i = 0; i < e->ports.size(); i++) {
+		ports->Set(i, Nan::New<Uint32>((uint32_t) e->ports[i]));
+	}
+	obj->Set(V8STR("portNumbers"), ports);
+	obj->Set(V8STR("speed"), Nan::New<Uint32>((uint32_t) e->speed));
+	obj->Set(V8STR("deviceDescriptor"), deviceDescriptorObject(e->dd));
+	if (!e->config.empty()) {
+		obj->Set(V8STR("rawConfigDescriptor"),
+			Nan::CopyBuffer((const char*) &e->config[0], (uint32_t) e->config.size()).ToLocalChecked());
+	}
+	if (e->job->strings) {
+		setString(obj, "manufacturer", e, e->dd.iManufacturer);
+		setString(obj, "product", e, e->dd.iProduct);
+		setString(obj, "serialNumber", e, e->dd.iSerialNumber);
+		if (e->stringError) {
+			obj->Set(V8STR("stringError"), libusbException(e->stringError));
+		}
+	}
+	return obj;
+}
+
+static void finish(EnumerateJob* job){
+	Nan::HandleScope scope;
+	Local<Value> argv[2] = {Nan::Undefined(), Nan::Undefined()};
+	if (job->errcode < 0) {
+		argv[0] = libusbException(job->errcode);
+	} else {
+		Local<Array> arr = Nan::New<Array>((int) job->entries.size());
+		for (size_t i = 0; i < job->entries.size(); i++) {
+			arr->Set(i, entryObject(job->entries[i]));
+		}
+		argv[1] = arr;
+	}
+
+	Local<Function> callback = Nan::New(job->callback);
+	delete job;
+
+	Nan::TryCatch try_catch;
+	Nan::MakeCallback(Nan::GetCurrentContext()->Global(), callback, 2, argv);
+	if (try_catch.HasCaught()) {
+		Nan::FatalException(try_catch);
+	}
+}
+
+static void entryDone(uv_work_t* req, int);
+
+// Keep up to `concurrency` devices in flight
+static void submitEntries(EnumerateJob* job){
+	while (job->submitted < job->entries.size()
+			&& job->submitted - job->done < (size_t) job->concurrency) {
+		EnumerateEntry* e = job->entries[job->submitted++];
+		e->req.data = e;
+		e->op.req = &e->req;
+		e->op.work = entryWork;
+		e->op.after = entryDone;
+		e->op.device = e->device;
+		e->op.env = job->env;
+		int r = controlPlaneSubmit(&e->op);
+		if (r < 0) {
+			// Only fails if no executor thread can be started at all
+			job->errcode = r;
+			job->done++;
+		}
+	}
+	if (job->done == job->entries.size()) {
+		finish(job);
+	}
+}
+
+static void entryDone(uv_work_t* req, int){
+	auto e = (EnumerateEntry*) req->data;
+	EnumerateJob* job = e->job;
+	job->done++;
+	submitEntries(job);
+}
+
+static void scanDone(uv_work_t* req, int){
+	auto job = (EnumerateJob*) req->data;
+	// By default, as many devices as there are threads to read them. The
+	// scan itself started the threads, so this is the number running.
+	if (job->concurrency == 0) {
+		int threads = controlPlaneThreads();
+		job->concurrency = threads > 0 ? threads : 1;
+	}
+	if (job->errcode < 0) {
+		finish(job);
+	} else {
+		submitEntries(job);
+	}
+}
+
+// _enumerate(idVendor, idProduct, strings, concurrency, callback): ids of -1
+// match any device, and a concurrency of 0 is one device per control-plane
+// thread
+NAN_METHOD(Enumerate_Start) {
+	Nan::HandleScope scope;
+	CHECK_N_ARGS(5);
+	int idVendor, idProduct, concurrency;
+	bool strings;
+	INT_ARG(idVendor, 0);
+	INT_ARG(idProduct, 1);
+	BOOL_ARG(strings, 2);
+	INT_ARG(concurrency, 3);
+	CALLBACK_ARG(4);
+	if (concurrency < 0) {
+		THROW_BAD_ARGS("Concurrency must be at least 1");
+	}
+
+	auto job = new EnumerateJob();
+	job->env = UsbEnv::current();
+	job->idVendor = idVendor;
+	job->idProduct = idProduct;
+	job->strings = strings;
+	job->concurrency = concurrency;
+	job->callback.Reset(callback);
+	job->req.data = job;
+	job->op.req = &job->req;
+	job->op.work = scanWork;
+	job->op.after = scanDone;
+	// The scan has a lane of its own
+	job->op.device = NULL;
+	job->op.env = job->env;
+
+	int r = controlPlaneSubmit(&job->op);
+	if (r < 0) {
+		delete job;
+		CHECK_USB(r);
+	}
+	info.GetReturnValue().Set(Nan::Undefined());
+}
+
+void Enumerate::Init(Local<Object> target){
+	Nan::SetMethod(target, "_enumerate", Enumerate_Start);
+}
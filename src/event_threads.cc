@@ -0,0 +1,339 @@
+#include "node_usb.h"
+#include <string.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#endif
+
+// Thread 0 handles events for the shared context, which devices are
+// enumerated on. Each further thread runs its own libusb context; devices
+// opened on one of those are looked up again in that context (see
+// Device_Open), so their transfers complete there.
+//
+// The threads belong to the process, not to an environment: any thread
+// (main or worker) may add or configure them, under eventThreadsLock.
+// Threads are never removed, so a pointer taken under the lock stays valid.
+static std::vector<EventThread*> eventThreads;
+static uv_mutex_t eventThreadsLock;
+
+extern libusb_context* usb_context;
+
+libusb_context* eventThreadContext(int index){
+	#ifdef USE_POLL
+	return index == 0 ? usb_context : NULL;
+	#else
+	libusb_context* ctx = NULL;
+	uv_mutex_lock(&eventThreadsLock);
+	if (index >= 0 && index < (int) eventThreads.size()) {
+		ctx = eventThreads[index]->context;
+	}
+	uv_mutex_unlock(&eventThreadsLock);
+	return ctx;
+	#endif
+}
+
+static EventThread* getEventThread(int index){
+	EventThread* thread = NULL;
+	uv_mutex_lock(&eventThreadsLock);
+	if (index >= 0 && index < (int) eventThreads.size()) {
+		thread = eventThreads[index];
+	}
+	uv_mutex_unlock(&eventThreadsLock);
+	return thread;
+}
+
+static void eventThreadFn(void* arg){
+	EventThread* self = static_cast<EventThread*>(arg);
+	while (self->running.load()) libusb_handle_events(self->context);
+}
+
+EventThread::EventThread(libusb_context* ctx): context(ctx), running(false),
+	policy(-1), priority(0) {}
+
+// start() and stop() are called under eventThreadsLock, so the settings
+// applied here can't change underneath
+int EventThread::start(){
+	if (running.load()) return 0;
+	running.store(true);
+	if (uv_thread_create(&thread, eventThreadFn, this) != 0) {
+		running.store(false);
+		return LIBUSB_ERROR_OTHER;
+	}
+	// Settings were checked when they were made
+	const char* failed;
+	applyConfig(&failed);
+	return 0;
+}
+
+int EventThread::stop(){
+	if (!running.load()) return 0;
+	#if defined(LIBUSB_API_VERSION) && LIBUSB_API_VERSION >= 0x01000105
+	running.store(false);
+	libusb_interrupt_event_handler(context);
+	uv_thread_join(&thread);
+	return 0;
+	#else
+	return LIBUSB_ERROR_NOT_SUPPORTED;
+	#endif
+}
+
+// Returns 0 or an errno value, with the call that failed in `failed`
+int EventThread::applyConfig(const char** failed){
+	if (!running.load()) return 0;
+
+	#ifdef _WIN32
+	if (!cpus.empty() || policy >= 0 || !name.empty()) {
+		*failed = "configureEventThread";
+		return ENOTSUP;
+	}
+	return 0;
+	#else
+	int r;
+	#ifdef __linux__
+	if (!cpus.empty()) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (size_t i = 0; i < cpus.size(); i++) {
+			CPU_SET(cpus[i], &set);
+		}
+		r = pthread_setaffinity_np(thread, sizeof(set), &set);
+		if (r) {
+			*failed = "pthread_setaffinity_np";
+			return r;
+		}
+	}
+	if (!name.empty()) {
+		// Linux thread names are limited to 15 characters
+		r = pthread_setname_np(thread, name.substr(0, 15).c_str());
+		if (r) {
+			*failed = "pthread_setname_np";
+			return r;
+		}
+	}
+	#else
+	if (!cpus.empty() || !name.empty()) {
+		*failed = "configureEventThread";
+		return ENOTSUP;
+	}
+	#endif
+
+	if (policy >= 0) {
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = priority;
+		r = pthread_setschedparam(thread, policy, &param);
+		if (r) {
+			*failed = "pthread_setschedparam";
+			return r;
+		}
+	}
+	return 0;
+	#endif
+}
+
+#define EVENT_THREAD_ARG(N) \
+	int index; \
+	INT_ARG(index, N); \
+	EventThread* thread = getEventThread(index); \
+	if (!thread) { \
+		THROW_BAD_ARGS("No such event thread"); \
+	}
+
+// setEventThreads(n): make sure at least n event threads exist and that the
+// new ones are running. Threads can be added but not removed.
+NAN_METHOD(SetEventThreads) {
+	Nan::HandleScope scope;
+	if (info.Length() != 1 || !info[0]->IsUint32() || info[0]->Uint32Value() < 1) {
+		THROW_BAD_ARGS("Usb::SetEventThreads argument is invalid. [uint:>=1]!")
+	}
+	int n = (int) info[0]->Uint32Value();
+
+	#ifdef USE_POLL
+	if (n > 1) {
+		THROW_ERROR("Multiple event threads are not available in poll mode");
+	}
+	#else
+	int r = LIBUSB_SUCCESS;
+	uv_mutex_lock(&eventThreadsLock);
+	while ((int) eventThreads.size() < n) {
+		libusb_context* ctx;
+		r = libusb_init(&ctx);
+		if (r < 0) break;
+		EventThread* thread = new EventThread(ctx);
+		r = thread->start();
+		if (r < 0) {
+			delete thread;
+			libusb_exit(ctx);
+			break;
+		}
+		eventThreads.push_back(thread);
+	}
+	uv_mutex_unlock(&eventThreadsLock);
+	CHECK_USB(r);
+	#endif
+	info.GetReturnValue().Set(Nan::Undefined());
+}
+
+NAN_METHOD(GetEventThreads) {
+	Nan::HandleScope scope;
+	#ifdef USE_POLL
+	info.GetReturnValue().Set(Nan::New<Uint32>(1));
+	#else
+	uv_mutex_lock(&eventThreadsLock);
+	uint32_t n = (uint32_t) eventThreads.size();
+	uv_mutex_unlock(&eventThreadsLock);
+	info.GetReturnValue().Set(Nan::New<Uint32>(n));
+	#endif
+}
+
+// stopEventThread(index): wake the thread and wait for it to exit. Transfers
+// of devices opened on it don't complete until it is started again.
+NAN_METHOD(StopEventThread) {
+	Nan::HandleScope scope;
+	EVENT_THREAD_ARG(0);
+	uv_mutex_lock(&eventThreadsLock);
+	int r = thread->stop();
+	uv_mutex_unlock(&eventThreadsLock);
+	CHECK_USB(r);
+	info.GetReturnValue().Set(Nan::Undefined());
+}
+
+NAN_METHOD(StartEventThread) {
+	Nan::HandleScope scope;
+	EVENT_THREAD_ARG(0);
+	uv_mutex_lock(&eventThreadsLock);
+	int r = thread->start();
+	uv_mutex_unlock(&eventThreadsLock);
+	CHECK_USB(r);
+	info.GetReturnValue().Set(Nan::Undefined());
+}
+
+// configureEventThread(index, {cpus, policy, priority, name}). Omitted
+// settings are left as they are.
+NAN_METHOD(ConfigureEventThread) {
+	Nan::HandleScope scope;
+	EVENT_THREAD_ARG(0);
+	if (info.Length() < 2 || !info[1]->IsObject()) {
+		THROW_BAD_ARGS("Options arg [1] must be an object");
+	}
+	Local<Object> options = info[1]->ToObject();
+
+	uv_mutex_lock(&eventThreadsLock);
+	std::vector<int> cpus = thread->cpus;
+	int policy = thread->policy;
+	int priority = thread->priority;
+	std::string name = thread->name;
+	uv_mutex_unlock(&eventThreadsLock);
+
+	Local<Value> v = Nan::Get(options, V8STR("cpus")).ToLocalChecked();
+	if (!v->IsUndefined()) {
+		if (!v->IsArray()) {
+			THROW_BAD_ARGS("cpus must be an array of CPU numbers");
+		}
+		Local<Array> arr = Local<Array>::Cast(v);
+		cpus.clear();
+		for (uint32_t i = 0; i < arr->Length(); i++) {
+			Local<Value> cpu = arr->Get(i);
+			if (!cpu->IsUint32() || cpu->Uint32Value() >= 1024) {
+				THROW_BAD_ARGS("cpus must be an array of CPU numbers");
+			}
+			cpus.push_back((int) cpu->Uint32Value());
+		}
+	}
+
+	v = Nan::Get(options, V8STR("policy")).ToLocalChecked();
+	if (!v->IsUndefined()) {
+		Nan::Utf8String s(v);
+		#ifdef _WIN32
+		policy = 0;
+		#else
+		if (strcmp(*s, "fifo") == 0) {
+			policy = SCHED_FIFO;
+		} else if (strcmp(*s, "rr") == 0) {
+			policy = SCHED_RR;
+		} else if (strcmp(*s, "other") == 0) {
+			policy = SCHED_OTHER;
+		} else {
+			THROW_BAD_ARGS("policy must be 'fifo', 'rr' or 'other'");
+		}
+		#endif
+	}
+
+	v = Nan::Get(options, V8STR("priority")).ToLocalChecked();
+	if (!v->IsUndefined()) {
+		if (!v->IsInt32()) {
+			THROW_BAD_ARGS("priority must be an integer");
+		}
+		priority = v->Int32Value();
+		// The priority only means something for a policy
+		if (policy < 0) {
+			THROW_BAD_ARGS("priority needs a policy");
+		}
+	}
+
+	v = Nan::Get(options, V8STR("name")).ToLocalChecked();
+	if (!v->IsUndefined()) {
+		Nan::Utf8String s(v);
+		name = *s;
+	}
+
+	uv_mutex_lock(&eventThreadsLock);
+	std::vector<int> oldCpus = thread->cpus;
+	int oldPolicy = thread->policy, oldPriority = thread->priority;
+	std::string oldName = thread->name;
+
+	thread->cpus = cpus;
+	thread->policy = policy;
+	thread->priority = priority;
+	thread->name = name;
+
+	const char* failed = NULL;
+	int r = thread->applyConfig(&failed);
+	if (r) {
+		// Keep the last settings that worked, so a restart doesn't fail again
+		thread->cpus = oldCpus;
+		thread->policy = oldPolicy;
+		thread->priority = oldPriority;
+		thread->name = oldName;
+	}
+	uv_mutex_unlock(&eventThreadsLock);
+	if (r) {
+		return Nan::ThrowError(Nan::ErrnoException(r, failed));
+	}
+	info.GetReturnValue().Set(Nan::Undefined());
+}
+
+#ifndef USE_POLL
+// Let the event threads finish cleanly rather than be torn down mid-call.
+// This is a process exit hook, as workers exiting must not stop them.
+static void stopEventThreads(){
+	uv_mutex_lock(&eventThreadsLock);
+	for (size_t i = 0; i < eventThreads.size(); i++) {
+		eventThreads[i]->stop();
+	}
+	uv_mutex_unlock(&eventThreadsLock);
+}
+#endif
+
+void EventThread::Start(libusb_context* shared){
+	uv_mutex_init(&eventThreadsLock);
+	#ifndef USE_POLL
+	EventThread* thread = new EventThread(shared);
+	uv_mutex_lock(&eventThreadsLock);
+	thread->start();
+	eventThreads.push_back(thread);
+	uv_mutex_unlock(&eventThreadsLock);
+	atexit(stopEventThreads);
+	#endif
+}
+
+void EventThread::Init(Local<Object> target){
+	Nan::SetMethod(target, "setEventThreads", SetEventThreads);
+	Nan::SetMethod(target, "getEventThreads", GetEventThreads);
+	Nan::SetMethod(target, "stopEventThread", StopEventThread);
+	Nan::SetMethod(target, "startEventThread", StartEventThread);
+	Nan::SetMethod(target, "configureEventThread", ConfigureEventThread);
+}
@@ -14,8 +14,8 @@ using namespace v8;
 
 const PropertyAttribute CONST_PROP = static_cast<PropertyAttribute>(ReadOnly|DontDelete);
 
-inline static void setConst(Handle<Object> obj, const char* const name, Handle<Value> value){
-	obj->ForceSet(Nan::New<String>(name).ToLocalChecked(), value, CONST_PROP);
+inline static void setConst(Local<Object> obj, const char* const name, Local<Value> value){
+	Nan::DefineOwnProperty(obj, Nan::New<String>(name).ToLocalChecked(), value, CONST_PROP);
 }
 
 #define ENTER_CONSTRUCTOR(MIN_ARGS) \
@@ -0,0 +1,349 @@
+#include "node_usb.h"
+
+extern "C" void LIBUSB_CALL streamCompletionCb(libusb_transfer *transfer);
+
+InStream::InStream(): device(NULL), slab(NULL), slotSize(0), running(false),
+	manualRelease(false), active(false), inFlight(0), queued(0), completed(0), overruns(0) {
+	uv_mutex_init(&mutex);
+	DEBUG_LOG("Created InStream %p", this);
+}
+
+InStream::~InStream(){
+	DEBUG_LOG("Freed InStream %p", this);
+	for (size_t i = 0; i < transfers.size(); i++) {
+		libusb_free_transfer(transfers[i]);
+	}
+	v8slab.Reset();
+	v8callback.Reset();
+	v8end.Reset();
+	uv_mutex_destroy(&mutex);
+}
+
+// new InStream(device, endpointAddr, type, timeout, transferSize, nTransfers, slab, callback, end, [manualRelease])
+NAN_METHOD(InStream_constructor) {
+	ENTER_CONSTRUCTOR(9);
+	UNWRAP_ARG(Device, device, 0);
+	int endpoint, type, timeout, transferSize, nTransfers;
+	INT_ARG(endpoint, 1);
+	INT_ARG(type, 2);
+	INT_ARG(timeout, 3);
+	INT_ARG(transferSize, 4);
+	INT_ARG(nTransfers, 5);
+	bool manualRelease;
+	BOOL_ARG(manualRelease, 9);
+	if (!Buffer::HasInstance(info[6])){
+		THROW_BAD_ARGS("Buffer arg [6] must be Buffer");
+	}
+	if (!info[7]->IsFunction() || !info[8]->IsFunction()){
+		THROW_BAD_ARGS("Callback args [7] and [8] must be functions");
+	}
+	Local<Object> slab = info[6]->ToObject();
+
+	if (transferSize <= 0 || nTransfers <= 0){
+		THROW_BAD_ARGS("Transfer size and count must be positive");
+	}
+	int numSlots = (int) (Buffer::Length(slab) / transferSize);
+	if (numSlots < nTransfers){
+		THROW_BAD_ARGS("Buffer must hold at least one slot per transfer");
+	}
+
+	setConst(info.This(), "device", info[0]);
+	auto self = new InStream();
+	self->attach(info.This());
+	self->device = device;
+	self->v8slab.Reset(slab);
+	self->slab = (unsigned char*) Buffer::Data(slab);
+	self->slotSize = transferSize;
+	self->manualRelease = manualRelease;
+	self->held.assign(numSlots, false);
+	self->freeSlots.reserve(numSlots);
+	self->parked.reserve(nTransfers);
+	self->v8callback.Reset(Local<Function>::Cast(info[7]));
+	self->v8end.Reset(Local<Function>::Cast(info[8]));
+
+	for (int i = 0; i < nTransfers; i++) {
+		libusb_transfer* t = libusb_alloc_transfer(0);
+		t->endpoint = endpoint;
+		t->type = type;
+		t->timeout = timeout;
+		t->length = transferSize;
+		t->callback = streamCompletionCb;
+		t->user_data = self;
+		self->transfers.push_back(t);
+	}
+
+	info.GetReturnValue().Set(info.This());
+}
+
+// InStream.start()
+NAN_METHOD(InStream_Start) {
+	ENTER_METHOD(InStream, 0);
+
+	if (self->running){
+		THROW_ERROR("Stream is already active")
+	}
+	if (!self->device->device_handle){
+		THROW_ERROR("Device is not open");
+	}
+
+	int numSlots = (int) (Buffer::Length(Nan::New(self->v8slab)) / self->slotSize);
+
+	// Any slots JS didn't release from a previous run are reclaimed
+	self->held.assign(numSlots, false);
+
+	uv_mutex_lock(&self->mutex);
+	self->freeSlots.clear();
+	for (int i = numSlots - 1; i >= 0; i--) {
+		self->freeSlots.push_back(i);
+	}
+	self->parked.clear();
+	self->active = true;
+
+	int r = LIBUSB_SUCCESS;
+	for (size_t i = 0; i < self->transfers.size(); i++) {
+		libusb_transfer* t = self->transfers[i];
+		// Can't be cached in constructor as device could be closed and re-opened
+		t->dev_handle = self->device->device_handle;
+		t->buffer = self->slotData(self->freeSlots.back());
+		r = libusb_submit_transfer(t);
+		if (r < 0) break;
+		self->freeSlots.pop_back();
+		self->inFlight++;
+	}
+
+	if (r < 0) {
+		self->active = false;
+	}
+	bool idle = self->inFlight == 0;
+	uv_mutex_unlock(&self->mutex);
+
+	if (r < 0) {
+		for (size_t i = 0; i < self->transfers.size(); i++) {
+			libusb_cancel_transfer(self->transfers[i]);
+		}
+	}
+
+	if (!idle) {
+		// Keep everything alive until finish()
+		self->running = true;
+		self->ref();
+		self->device->ref();
+		#ifndef USE_POLL
+		self->device->env->streamQueue.ref();
+		#endif
+	}
+
+	CHECK_USB(r);
+	info.GetReturnValue().Set(info.This());
+}
+
+// InStream.stop()
+NAN_METHOD(InStream_Stop) {
+	ENTER_METHOD(InStream, 0);
+
+	uv_mutex_lock(&self->mutex);
+	self->active = false;
+	self->parked.clear();
+	uv_mutex_unlock(&self->mutex);
+
+	// Not-in-flight transfers just report LIBUSB_ERROR_NOT_FOUND
+	for (size_t i = 0; i < self->transfers.size(); i++) {
+		libusb_cancel_transfer(self->transfers[i]);
+	}
+
+	uv_mutex_lock(&self->mutex);
+	bool done = self->inFlight == 0 && self->queued == 0;
+	uv_mutex_unlock(&self->mutex);
+
+	if (done) {
+		self->finish();
+	}
+	info.GetReturnValue().Set(info.This());
+}
+
+// InStream.release(slot)
+NAN_METHOD(InStream_Release) {
+	ENTER_METHOD(InStream, 1);
+	int slot;
+	INT_ARG(slot, 0);
+
+	if (slot < 0 || slot >= (int) self->held.size() || !self->held[slot]){
+		THROW_ERROR("Slot is not held");
+	}
+	self->held[slot] = false;
+
+	CHECK_USB(self->releaseSlot(slot));
+	info.GetReturnValue().Set(Nan::Undefined());
+}
+
+// InStream.stats()
+NAN_METHOD(InStream_Stats) {
+	ENTER_METHOD(InStream, 0);
+	Local<Object> stats = Nan::New<Object>();
+
+	uv_mutex_lock(&self->mutex);
+	stats->Set(V8STR("completed"), Nan::New<Number>(self->completed));
+	stats->Set(V8STR("overruns"), Nan::New<Number>(self->overruns));
+	stats->Set(V8STR("inFlight"), Nan::New<Uint32>((uint32_t) self->inFlight));
+	stats->Set(V8STR("freeSlots"), Nan::New<Uint32>((uint32_t) self->freeSlots.size()));
+	uv_mutex_unlock(&self->mutex);
+
+	info.GetReturnValue().Set(stats);
+}
+
+extern "C" void LIBUSB_CALL streamCompletionCb(libusb_transfer *transfer){
+	InStream* s = static_cast<InStream*>(transfer->user_data);
+	StreamCompletion c = {s, s->slotOf(transfer), transfer->status, transfer->actual_length, 0};
+	DEBUG_LOG("Stream completion %p slot %i", s, c.slot);
+
+	bool rearm = transfer->status == LIBUSB_TRANSFER_COMPLETED
+		|| transfer->status == LIBUSB_TRANSFER_TIMED_OUT;
+
+	// Submitting under the stream lock keeps stop() from missing a transfer
+	// that is between completion and resubmission. libusb does not call
+	// back into us from libusb_submit_transfer, so this can't deadlock.
+	uv_mutex_lock(&s->mutex);
+	s->queued++;
+	s->completed++;
+	if (s->active && rearm) {
+		if (!s->freeSlots.empty()) {
+			transfer->buffer = s->slotData(s->freeSlots.back());
+			c.submit_error = libusb_submit_transfer(transfer);
+			if (c.submit_error == LIBUSB_SUCCESS) {
+				s->freeSlots.pop_back();
+			} else {
+				s->inFlight--;
+			}
+		} else {
+			// JS still holds every slot: leave this transfer idle until
+			// one is released.
+			s->parked.push_back(transfer);
+			s->overruns++;
+			s->inFlight--;
+		}
+	} else {
+		s->inFlight--;
+	}
+	uv_mutex_unlock(&s->mutex);
+
+	#ifdef USE_POLL
+	handleStreamCompletion(c);
+	#else
+	s->device->env->streamQueue.post(c);
+	#endif
+}
+
+// Return a slot to the ring, re-arming a parked transfer with it if there is one
+int InStream::releaseSlot(int slot){
+	int r = LIBUSB_SUCCESS;
+	uv_mutex_lock(&mutex);
+	if (active && !parked.empty()) {
+		libusb_transfer* t = parked.back();
+		t->buffer = slotData(slot);
+		r = libusb_submit_transfer(t);
+		if (r == LIBUSB_SUCCESS) {
+			parked.pop_back();
+			inFlight++;
+		} else {
+			freeSlots.push_back(slot);
+		}
+	} else {
+		freeSlots.push_back(slot);
+	}
+	uv_mutex_unlock(&mutex);
+	return r;
+}
+
+void InStream::finish(){
+	if (!running) return;
+	running = false;
+	DEBUG_LOG("Stream finished %p", this);
+
+	Nan::HandleScope scope;
+	device->unref();
+	#ifndef USE_POLL
+	device->env->streamQueue.unref();
+	#endif
+
+	Nan::TryCatch try_catch;
+	Nan::MakeCallback(handle(), Nan::New(v8end), 0, NULL);
+	if (try_catch.HasCaught()) {
+		Nan::FatalException(try_catch);
+	}
+
+	Unref();
+}
+
+void handleStreamCompletion(StreamCompletion c){
+	Nan::HandleScope scope;
+	InStream* self = c.stream;
+	DEBUG_LOG("HandleStreamCompletion %p slot %i", self, c.slot);
+
+	bool hasData = c.status == LIBUSB_TRANSFER_COMPLETED
+		|| (c.status == LIBUSB_TRANSFER_TIMED_OUT && c.actual_length > 0);
+
+	int errcode = c.submit_error;
+	if (c.status != LIBUSB_TRANSFER_COMPLETED
+		&& c.status != LIBUSB_TRANSFER_TIMED_OUT
+		&& c.status != LIBUSB_TRANSFER_CANCELLED) {
+		errcode = c.status;
+	}
+
+	Nan::TryCatch try_catch;
+	if (hasData && self->manualRelease) {
+		// Nothing is allocated here: the slot stays with JS, which already
+		// has a Buffer for it, until it calls release().
+		self->held[c.slot] = true;
+		Local<Value> argv[] = {Nan::Undefined(), Nan::New<Int32>(c.slot),
+			Nan::New<Uint32>((uint32_t) c.actual_length)};
+		Nan::MakeCallback(self->handle(), Nan::New(self->v8callback), 3, argv);
+		if (try_catch.HasCaught()) {
+			Nan::FatalException(try_catch);
+			try_catch.Reset();
+		}
+	} else {
+		if (hasData) {
+			Local<Value> argv[] = {Nan::Undefined(),
+				Nan::CopyBuffer((char*) self->slotData(c.slot), c.actual_length).ToLocalChecked(),
+				Nan::New<Uint32>((uint32_t) c.actual_length)};
+			Nan::MakeCallback(self->handle(), Nan::New(self->v8callback), 3, argv);
+			if (try_catch.HasCaught()) {
+				Nan::FatalException(try_catch);
+				try_catch.Reset();
+			}
+		}
+
+		int r = self->releaseSlot(c.slot);
+		if (errcode == 0) errcode = r;
+	}
+
+	if (errcode != 0) {
+		Local<Value> argv[] = {libusbException(errcode)};
+		Nan::MakeCallback(self->handle(), Nan::New(self->v8callback), 1, argv);
+		if (try_catch.HasCaught()) {
+			Nan::FatalException(try_catch);
+		}
+	}
+
+	uv_mutex_lock(&self->mutex);
+	self->queued--;
+	bool done = !self->active && self->inFlight == 0 && self->queued == 0;
+	uv_mutex_unlock(&self->mutex);
+
+	if (done) {
+		self->finish();
+	}
+}
+
+void InStream::Init(Local<Object> target){
+	Local<FunctionTemplate> tpl = Nan::New<FunctionTemplate>(InStream_constructor);
+	tpl->SetClassName(Nan::New("InStream").ToLocalChecked());
+	tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+	Nan::SetPrototypeMethod(tpl, "start", InStream_Start);
+	Nan::SetPrototypeMethod(tpl, "stop", InStream_Stop);
+	Nan::SetPrototypeMethod(tpl, "release", InStream_Release);
+	Nan::SetPrototypeMethod(tpl, "stats", InStream_Stats);
+
+	target->Set(Nan::New("InStream").ToLocalChecked(), tpl->GetFunction());
+}
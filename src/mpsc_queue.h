@@ -0,0 +1,89 @@
+#ifndef SRC_MPSC_QUEUE_H
+#define SRC_MPSC_QUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+
+// Bounded lock-free multi-producer / single-consumer ring (after Dmitry
+// Vyukov's bounded MPMC queue). Each cell carries a sequence number telling
+// producers and the consumer whose turn it is, so push() is one CAS on the
+// tail plus two stores and pop() never touches shared counters. Storage is
+// allocated once up front; push() fails instead of growing when full.
+template <class T>
+class MPSCQueue{
+	public:
+		// capacity is rounded up to a power of two
+		explicit MPSCQueue(size_t capacity): head(0), tail(0) {
+			size_t n = 2;
+			while (n < capacity) n <<= 1;
+			mask = n - 1;
+			cells = new Cell[n];
+			for (size_t i = 0; i < n; i++) {
+				cells[i].seq.store(i, std::memory_order_relaxed);
+			}
+		}
+
+		~MPSCQueue(){
+			delete[] cells;
+		}
+
+		// Safe to call from any thread. Returns false if the queue is full.
+		bool push(const T& value){
+			Cell* cell;
+			size_t pos = tail.load(std::memory_order_relaxed);
+			while (1) {
+				cell = &cells[pos & mask];
+				size_t seq = cell->seq.load(std::memory_order_acquire);
+				ptrdiff_t dif = (ptrdiff_t) seq - (ptrdiff_t) pos;
+				if (dif == 0) {
+					if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+				} else if (dif < 0) {
+					return false;
+				} else {
+					pos = tail.load(std::memory_order_relaxed);
+				}
+			}
+			cell->value = value;
+			cell->seq.store(pos + 1, std::memory_order_release);
+			return true;
+		}
+
+		// Consumer thread only. Returns false if nothing is ready. An item
+		// whose producer is still between its CAS and its publish reads as
+		// not ready yet; the producer's wakeup will follow.
+		bool pop(T& value){
+			Cell* cell = &cells[head & mask];
+			size_t seq = cell->seq.load(std::memory_order_acquire);
+			if (seq != head + 1) return false;
+			value = cell->value;
+			cell->seq.store(head + mask + 1, std::memory_order_release);
+			head++;
+			return true;
+		}
+
+		// Consumer thread only. True once every item pushed so far has been
+		// popped; false while a producer is still publishing one.
+		bool empty(){
+			return head == tail.load(std::memory_order_acquire);
+		}
+
+	private:
+		struct Cell{
+			std::atomic<size_t> seq;
+			T value;
+		};
+
+		MPSCQueue(const MPSCQueue&);
+		MPSCQueue& operator=(const MPSCQueue&);
+
+		Cell* cells;
+		size_t mask;
+		// Keep the consumer and producer cursors on separate cache lines
+		char pad0[64];
+		size_t head;
+		char pad1[64];
+		std::atomic<size_t> tail;
+		char pad2[64];
+};
+
+#endif
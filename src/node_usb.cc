@@ -1,5 +1,4 @@
 #include "node_usb.h"
-#include "uv_async_queue.h"
 
 NAN_METHOD(SetDebugLevel);
 NAN_METHOD(GetDeviceList);
@@ -15,10 +14,20 @@ libusb_context* usb_context;
 
 std::map<int, uv_poll_t*> pollByFD;
 
+// Loop of the one environment libusb's fds are watched on
+uv_loop_t* pollLoop;
+
 struct timeval zero_tv = {0, 0};
 
+// Each watched fd reaps only its own device, so one busy device doesn't make
+// every event pass scan all of them. Completions run inline, on this thread.
 void onPollSuccess(uv_poll_t* handle, int status, int events){
+	#ifdef LIBUSB_HAS_HANDLE_EVENTS_FD
+	libusb_handle_events_fd(usb_context, (int) (intptr_t) handle->data);
+	#else
 	libusb_handle_events_timeout(usb_context, &zero_tv);
+	#endif
+	flushCompletions();
 }
 
 void LIBUSB_CALL onPollFDAdded(int fd, short events, void *user_data){
@@ -28,7 +37,8 @@ void LIBUSB_CALL onPollFDAdded(int fd, short events, void *user_data){
 		poll_fd = it->second;
 	}else{
 		poll_fd = (uv_poll_t*) malloc(sizeof(uv_poll_t));
-		uv_poll_init(uv_default_loop(), poll_fd, fd);
+		uv_poll_init(pollLoop, poll_fd, fd);
+		poll_fd->data = (void*) (intptr_t) fd;
 		pollByFD.insert(std::make_pair(fd, poll_fd));
 	}
 
@@ -48,25 +58,134 @@ void LIBUSB_CALL onPollFDRemoved(int fd, void *user_data){
 	}
 }
 
-#else
-uv_thread_t usb_thread;
+#endif
+
+static thread_local UsbEnv* currentEnv = NULL;
 
-void USBThreadFn(void*){
-	while(1) libusb_handle_events(usb_context);
+UsbEnv* UsbEnv::current(){
+	return currentEnv;
+}
+
+UsbEnv::UsbEnv(Isolate* isolate, uv_loop_t* loop): isolate(isolate), loop(loop),
+	devices(isolate), hotplugEnabled(false), hotplugQueue(loop, handleHotplug),
+	controlPlaneQueue(loop, handleControlPlaneDone),
+	#ifndef USE_POLL
+	completionQueue(loop, handleCompletion, 0, flushCompletions),
+	streamQueue(loop, handleStreamCompletion),
+	ringQueue(loop, handleRingWake),
+	channelQueue(loop, handleChannelCompletion),
+	controlQueue(loop, handleControlCompletion),
+	pollerQueue(loop, handlePollerCompletion),
+	#endif
+	closing(0) {}
+
+static void onEnvQueueClosed(void* arg){
+	UsbEnv* env = static_cast<UsbEnv*>(arg);
+	if (--env->closing > 0) return;
+
+	// Transfers still in flight will post to the queues when they complete,
+	// so with any outstanding the state has to be left behind.
+	if (env->controlPlaneQueue.refs()) return;
+	#ifndef USE_POLL
+	if (env->completionQueue.refs() || env->streamQueue.refs()
+		|| env->ringQueue.refs() || env->channelQueue.refs()
+		|| env->controlQueue.refs() || env->pollerQueue.refs()) {
+		return;
+	}
+	#endif
+	delete env;
+}
+
+// Runs on the environment's thread when it shuts down (a worker exiting),
+// while its isolate is still usable. Everything on its loop is closed, as
+// the loop goes away with it.
+static void cleanupEnv(void* arg){
+	UsbEnv* env = static_cast<UsbEnv*>(arg);
+	currentEnv = NULL;
+
+	if (env->hotplugEnabled) {
+		libusb_hotplug_deregister_callback(usb_context, env->hotplugHandle);
+		env->hotplugEnabled = false;
+	}
+
+	env->devices.Clear();
+	env->deviceConstructor.Reset();
+	env->batchHandler.Reset();
+	env->hotplugThis.Reset();
+
+	for (auto it = env->channels.begin(); it != env->channels.end(); ++it) {
+		(*it)->closeTimer();
+	}
+	env->channels.clear();
+
+	#ifdef USE_POLL
+	libusb_set_pollfd_notifiers(usb_context, NULL, NULL, NULL);
+	for (auto it = pollByFD.begin(); it != pollByFD.end(); ++it) {
+		uv_poll_stop(it->second);
+		uv_close((uv_handle_t*) it->second, (uv_close_cb) free);
+	}
+	pollByFD.clear();
+	pollLoop = NULL;
+
+	env->closing = 2;
+	#else
+	env->closing = 8;
+	env->completionQueue.close(onEnvQueueClosed, env);
+	env->streamQueue.close(onEnvQueueClosed, env);
+	env->ringQueue.close(onEnvQueueClosed, env);
+	env->channelQueue.close(onEnvQueueClosed, env);
+	env->controlQueue.close(onEnvQueueClosed, env);
+	env->pollerQueue.close(onEnvQueueClosed, env);
+	#endif
+	env->hotplugQueue.close(onEnvQueueClosed, env);
+	env->controlPlaneQueue.close(onEnvQueueClosed, env);
+}
+
+void UsbEnv::Init(Local<Object> target){
+	UsbEnv* env = new UsbEnv(Isolate::GetCurrent(), Nan::GetCurrentEventLoop());
+	currentEnv = env;
+
+	// Before this, an addon is only ever loaded once per process, and its
+	// state lives until exit
+	#if NODE_MAJOR_VERSION >= 10
+	node::AddEnvironmentCleanupHook(env->isolate, cleanupEnv, env);
+	#endif
+}
+
+// libusb and its event threads are shared by every environment; the first
+// one to load the addon sets them up
+static uv_once_t usbInitOnce = UV_ONCE_INIT;
+static int usbInitResult;
+
+static void initUsb(){
+	ControlPlane::Start();
+	usbInitResult = libusb_init(&usb_context);
+	if (usbInitResult == 0) {
+		EventThread::Start(usb_context);
+	}
 }
-#endif
 
 extern "C" void Initialize(Local<Object> target) {
 	Nan::HandleScope scope;
 
 	// Initialize libusb. On error, halt initialization.
-	int res = libusb_init(&usb_context);
-	target->Set(Nan::New<String>("INIT_ERROR").ToLocalChecked(), Nan::New<Number>(res));
-	if (res != 0) {
+	uv_once(&usbInitOnce, initUsb);
+	target->Set(Nan::New<String>("INIT_ERROR").ToLocalChecked(), Nan::New<Number>(usbInitResult));
+	if (usbInitResult != 0) {
 		return;
 	}
 
 	#ifdef USE_POLL
+	// Events are handled on one loop, so only one environment can have them
+	if (pollLoop) {
+		return Nan::ThrowError("Single-threaded mode can't be used from more than one thread");
+	}
+	#endif
+
+	UsbEnv::Init(target);
+
+	#ifdef USE_POLL
+	pollLoop = UsbEnv::current()->loop;
 	assert(libusb_pollfds_handle_timeouts(usb_context));
 	libusb_set_pollfd_notifiers(usb_context, onPollFDAdded, onPollFDRemoved, NULL);
 
@@ -77,12 +196,17 @@ extern "C" void Initialize(Local<Object> target) {
 	}
 	free(pollfds);
 
-	#else
-	uv_thread_create(&usb_thread, USBThreadFn, NULL);
 	#endif
 
+	EventThread::Init(target);
+	ControlPlane::Init(target);
 	Device::Init(target);
+	Registry::Init(target);
+	Enumerate::Init(target);
 	Transfer::Init(target);
+	InStream::Init(target);
+	RingStream::Init(target);
+	OutChannel::Init(target);
 	Poller::Init(target);
 
 	Nan::SetMethod(target, "setDebugLevel", SetDebugLevel);
@@ -92,7 +216,11 @@ extern "C" void Initialize(Local<Object> target) {
 	initConstants(target);
 }
 
+#ifdef NAN_MODULE_WORKER_ENABLED
+NAN_MODULE_WORKER_ENABLED(usb_bindings, Initialize)
+#else
 NODE_MODULE(usb_bindings, Initialize)
+#endif
 
 NAN_METHOD(SetDebugLevel) {
 	Nan::HandleScope scope;
@@ -119,9 +247,7 @@ NAN_METHOD(GetDeviceList) {
 	info.GetReturnValue().Set(arr);
 }
 
-Nan::Persistent<Object> hotplugThis;
-
-void handleHotplug(std::pair<libusb_device*, libusb_hotplug_event> info){
+void handleHotplug(HotplugEvent info){
 	Nan::HandleScope scope;
 
 	libusb_device* dev = info.first;
@@ -148,41 +274,41 @@ void handleHotplug(std::pair<libusb_device*, libusb_hotplug_event> info){
 	}
 
 	Local<Value> argv[] = {eventName, v8dev};
-	Nan::MakeCallback(Nan::New<Object>(hotplugThis), "emit", 2, argv);
+	Nan::MakeCallback(Nan::New<Object>(UsbEnv::current()->hotplugThis), "emit", 2, argv);
 }
 
-bool hotplugEnabled = 0;
-libusb_hotplug_callback_handle hotplugHandle;
-UVQueue<std::pair<libusb_device*, libusb_hotplug_event>> hotplugQueue(handleHotplug);
-
+// Each environment registers its own callback, with itself as user_data
 int LIBUSB_CALL hotplug_callback(libusb_context *ctx, libusb_device *dev,
                      libusb_hotplug_event event, void *user_data) {
+	UsbEnv* env = static_cast<UsbEnv*>(user_data);
 	libusb_ref_device(dev);
-	hotplugQueue.post(std::pair<libusb_device*, libusb_hotplug_event>(dev, event));
+	env->hotplugQueue.post(HotplugEvent(dev, event));
 	return 0;
 }
 
 NAN_METHOD(EnableHotplugEvents) {
 	Nan::HandleScope scope;
+	UsbEnv* env = UsbEnv::current();
 
-	if (!hotplugEnabled) {
-		hotplugThis.Reset(info.This());
+	if (!env->hotplugEnabled) {
+		env->hotplugThis.Reset(info.This());
 		CHECK_USB(libusb_hotplug_register_callback(usb_context,
 			(libusb_hotplug_event)(LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT),
 			(libusb_hotplug_flag)0, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
-			hotplug_callback, NULL, &hotplugHandle));
-		hotplugQueue.ref();
-		hotplugEnabled = true;
+			hotplug_callback, env, &env->hotplugHandle));
+		env->hotplugQueue.ref();
+		env->hotplugEnabled = true;
 	}
 	info.GetReturnValue().Set(Nan::Undefined());
 }
 
 NAN_METHOD(DisableHotplugEvents) {
 	Nan::HandleScope scope;
-	if (hotplugEnabled) {
-		libusb_hotplug_deregister_callback(usb_context, hotplugHandle);
-		hotplugQueue.unref();
-		hotplugEnabled = false;
+	UsbEnv* env = UsbEnv::current();
+	if (env->hotplugEnabled) {
+		libusb_hotplug_deregister_callback(usb_context, env->hotplugHandle);
+		env->hotplugQueue.unref();
+		env->hotplugEnabled = false;
 	}
 	info.GetReturnValue().Set(Nan::Undefined());
 }
@@ -230,6 +356,7 @@ void initConstants(Local<Object> target){
 	NODE_DEFINE_CONSTANT(target, LIBUSB_TRANSFER_TYPE_ISOCHRONOUS);
 	NODE_DEFINE_CONSTANT(target, LIBUSB_TRANSFER_TYPE_BULK);
 	NODE_DEFINE_CONSTANT(target, LIBUSB_TRANSFER_TYPE_INTERRUPT);
+	NODE_DEFINE_CONSTANT(target, LIBUSB_TRANSFER_TYPE_BULK_STREAM);
 	// libusb_iso_sync_type
 	NODE_DEFINE_CONSTANT(target, LIBUSB_ISO_SYNC_TYPE_NONE);
 	NODE_DEFINE_CONSTANT(target, LIBUSB_ISO_SYNC_TYPE_ASYNC);
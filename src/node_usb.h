@@ -4,6 +4,10 @@
 #include <assert.h>
 #include <string>
 #include <map>
+#include <vector>
+#include <deque>
+#include <set>
+#include <atomic>
 
 #ifdef _WIN32
 #include <WinSock2.h>
@@ -21,15 +25,77 @@ using namespace v8;
 using namespace node;
 
 #include "helpers.h"
+#include "uv_async_queue.h"
 
 //#define DEBUG
 
 Local<Value> libusbException(int errorno);
 
+// Hand transfers completed during this wakeup to the JS batch handler, if any
+void flushCompletions();
+
+// libusb context of event thread `index`, or NULL if there is no such thread.
+// Thread 0's context is the one devices are enumerated on.
+libusb_context* eventThreadContext(int index);
+
+// A thread running libusb_handle_events() on its own context (thread 0 runs
+// the shared usb_context). Not used in USE_POLL builds, where events are
+// handled on the main loop.
+struct EventThread {
+  libusb_context *context;
+  uv_thread_t thread;
+  std::atomic<bool> running;
+
+  // Scheduling settings, applied when set and again on every start.
+  // policy is -1 to leave the scheduler alone.
+  std::vector<int> cpus;
+  int policy;
+  int priority;
+  std::string name;
+
+  EventThread(libusb_context *ctx);
+  int start();
+  int stop();
+  int applyConfig(const char **failed);
+
+  // Starts thread 0 for the shared context, once per process
+  static void Start(libusb_context *shared);
+  static void Init(Local<Object> exports);
+};
+
+// Index of attached devices by ids, serial number, port path and class,
+// kept current by hotplug events (see registry.cc)
+struct Registry {
+  static void Init(Local<Object> exports);
+
+  // String descriptor cache, dropped with the device when it is detached.
+  // Thread-safe. get* return false on a miss.
+  static bool getString(libusb_device *dev, uint8_t index, uint16_t langid, std::string &out);
+  static bool getLangids(libusb_device *dev, std::vector<uint16_t> &out);
+  // Decode and cache a string descriptor as read from the device. Returns
+  // false if it isn't one.
+  static bool putStringDescriptor(libusb_device *dev, uint8_t index, uint16_t langid,
+    const unsigned char *desc, int length, std::string &out);
+  static bool putLangids(libusb_device *dev, const unsigned char *desc, int length,
+    std::vector<uint16_t> &out);
+};
+
+struct UsbEnv;
+
 struct Device : public Nan::ObjectWrap {
   libusb_device *device;
   libusb_device_handle *device_handle;
 
+  // Environment the device was wrapped in; its transfers complete there
+  UsbEnv *env;
+
+  // deviceDescriptor and portNumbers, built on first access
+  Nan::Persistent<Object> v8descriptor;
+  Nan::Persistent<Array> v8ports;
+
+  // Raw configuration descriptors by bConfigurationValue, see __getConfigBlob
+  Nan::Persistent<Object> v8configs;
+
   static void Init(Local<Object> exports);
 
   static Local<Object> get(libusb_device *handle);
@@ -45,11 +111,20 @@ struct Device : public Nan::ObjectWrap {
   ~Device();
 
 protected:
-  static StdPersistentValueMap<libusb_device*, v8::Object> byPtr;
-
   Device(libusb_device *d);
 };
 
+// JS object with the fields of a device descriptor
+Local<Object> deviceDescriptorObject(const libusb_device_descriptor &dd);
+
+// Raw descriptors of a configuration, in the order the device sent them
+void serializeConfig(const libusb_config_descriptor *cdesc, std::vector<unsigned char> &out);
+
+// usb._enumerate(), see enumerate.cc
+struct Enumerate {
+  static void Init(Local<Object> exports);
+};
+
 
 struct Transfer : public Nan::ObjectWrap {
   libusb_transfer *transfer;
@@ -57,6 +132,11 @@ struct Transfer : public Nan::ObjectWrap {
   Nan::Persistent<Object> v8buffer;
   Nan::Persistent<Function> v8callback;
 
+  // Gathered submits: native buffer from BufferPool holding the
+  // concatenated Buffers, in place of v8buffer
+  unsigned char *pooled;
+  size_t pooledCapacity;
+
   static void Init(Local<Object> exports);
 
   inline void ref() { Ref(); }
@@ -65,15 +145,308 @@ struct Transfer : public Nan::ObjectWrap {
 
   inline void attach(Local<Object> o) { Wrap(o); }
 
-  Transfer();
+  // Isochronous only: Uint32Array of [actual_length, status] per packet
+  Local<Value> packetDescriptors();
+  Local<Value> transferBuffer();
+  void releaseBuffer();
+
+  Transfer(int isoPackets = 0);
 
   ~Transfer();
 };
 
+// Continuously armed IN endpoint. Transfers are resubmitted on the libusb
+// event thread into free slots of a preallocated buffer ring, and only
+// filled slots are passed to JS, so the endpoint stays armed while the
+// main thread is busy.
+struct InStream : public Nan::ObjectWrap {
+  Device *device;
+  std::vector<libusb_transfer*> transfers;
+  Nan::Persistent<Object> v8slab;
+  unsigned char *slab;
+  size_t slotSize;
+  Nan::Persistent<Function> v8callback;
+  Nan::Persistent<Function> v8end;
+  bool running;
+
+  // In manual release mode JS gets slot indices instead of copies, and
+  // hands each slot back with release() once it is done with the data.
+  bool manualRelease;
+  std::vector<bool> held;
+
+  // Shared with the event thread, guarded by mutex
+  uv_mutex_t mutex;
+  std::vector<int> freeSlots;
+  std::vector<libusb_transfer*> parked;
+  bool active;
+  int inFlight;
+  int queued;
+  double completed;
+  double overruns;
+
+  static void Init(Local<Object> exports);
+
+  inline void attach(Local<Object> o) { Wrap(o); }
+
+  inline void ref() { Ref(); }
+
+  inline unsigned char *slotData(int slot) { return slab + slot * slotSize; }
+
+  inline int slotOf(libusb_transfer *t) { return (int) ((t->buffer - slab) / slotSize); }
+
+  int releaseSlot(int slot);
+
+  void finish();
+
+  InStream();
+
+  ~InStream();
+};
+
+struct StreamCompletion {
+  InStream *stream;
+  int slot;
+  int status;
+  int actual_length;
+  int submit_error;
+};
+
+// Layout of a RingStream's SharedArrayBuffer, in 32-bit words. Kept in
+// sync with ring_reader.js. HEAD and TAIL count slots published by the
+// event thread and consumed by JS; the per-slot lengths follow the header
+// and the slot data starts at the next 64-byte boundary.
+enum {
+  RING_HEAD,
+  RING_TAIL,
+  RING_OVERRUNS,
+  RING_WAITING,
+  RING_STATE,
+  RING_SLOTS,
+  RING_SLOT_SIZE,
+  RING_ERROR,
+  RING_HEADER_WORDS
+};
+
+inline size_t ringDataOffset(int slots) {
+  return ((RING_HEADER_WORDS + slots) * 4 + 63) & ~(size_t) 63;
+}
+
+// Continuously armed IN endpoint that publishes straight into a
+// SharedArrayBuffer ring, read by JS (typically in a worker) without any
+// per-transfer callback. Transfers read into the slot they will be
+// published in; when the consumer is a full ring behind, they read into a
+// private scratch buffer instead and the data is counted as an overrun.
+struct RingStream : public Nan::ObjectWrap {
+  Device *device;
+  std::vector<libusb_transfer*> transfers;
+  unsigned char *scratch;
+  Nan::Persistent<Object> v8sab;
+  Nan::Persistent<Function> v8notify;
+  Nan::Persistent<Function> v8end;
+  int32_t *header;
+  unsigned char *data;
+  int slots;
+  size_t slotSize;
+  bool running;
+
+  // Shared with the event thread, guarded by mutex
+  uv_mutex_t mutex;
+  std::vector<bool> ready;
+  uint32_t head;
+  uint32_t next;
+  bool active;
+  int inFlight;
+  int queued;
+  int error;
+  double completed;
+  double overruns;
+
+  static void Init(Local<Object> exports);
+
+  inline void attach(Local<Object> o) { Wrap(o); }
+
+  inline void ref() { Ref(); }
+
+  inline std::atomic<int32_t> &word(int index) {
+    // std::atomic<int32_t> is a plain lock-free int32_t, which is also
+    // what JS Atomics operate on
+    return *reinterpret_cast<std::atomic<int32_t>*>(header + index);
+  }
+
+  inline unsigned char *slotData(int slot) { return data + slot * slotSize; }
+
+  inline int slotOf(libusb_transfer *t) {
+    if (t->buffer < data || t->buffer >= data + slots * slotSize) return -1;
+    return (int) ((t->buffer - data) / slotSize);
+  }
+
+  int arm(libusb_transfer *t);
+
+  void cancel();
+
+  void finish();
+
+  RingStream();
+
+  ~RingStream();
+};
+
+struct OutChannel;
+class Poller;
+
+// One coalesced OUT transfer: the bytes of `writes` consecutive writes,
+// the first of which was the channel's write number `first`
+struct OutBatch {
+  OutChannel *channel;
+  libusb_transfer *transfer;
+  unsigned char *data;
+  int capacity;
+  int used;
+  int writes;
+  uint32_t first;
+};
+
+// Gathers small OUT writes into one transfer of up to maxSize bytes, sent
+// when full or `delay` ms after the first write, with at most maxTransfers
+// in flight. Completion is reported to JS as (error, first write number,
+// number of writes), so batches can complete in any order.
+struct OutChannel : public Nan::ObjectWrap {
+  Device *device;
+  unsigned char endpoint;
+  int type;
+  unsigned int timeout;
+  int maxSize;
+  int delay;
+  int maxTransfers;
+  Nan::Persistent<Function> v8callback;
+
+  OutBatch *current;
+  std::vector<OutBatch*> idle;
+  std::deque<OutBatch*> ready;
+  int inFlight;
+  // Writes accepted so far, wrapping at 2^32
+  uint32_t written;
+  uv_timer_t *timer;
+  UsbEnv *env;
+  bool timerActive;
+  bool held;
+
+  static void Init(Local<Object> exports);
+
+  inline void attach(Local<Object> o) { Wrap(o); }
+
+  OutBatch *takeBatch(int length);
+
+  void flush();
+
+  void submitReady();
+
+  void completeBatch(OutBatch *batch, int errcode);
+
+  void updateHold();
+
+  void closeTimer();
+
+  OutChannel();
+
+  ~OutChannel();
+};
+
+// In-flight Device.__controlTransfer(). The setup packet is written into a
+// pooled buffer and the request is recycled once its callback has run.
+struct ControlRequest {
+  Device *device;
+  libusb_transfer *transfer;
+  unsigned char *data;
+  size_t capacity;
+  Nan::Persistent<Function> v8callback;
+};
+
+NAN_METHOD(Device_ControlTransfer);
+
+// Blocking device management call (reset, set configuration, ...) for the
+// control-plane executor. `work` runs on an executor thread, then `after`
+// on the loop of `env`. Calls for the same device run in submission order.
+struct ControlPlaneOp {
+  uv_work_t *req;
+  uv_work_cb work;
+  uv_after_work_cb after;
+  libusb_device *device;
+  UsbEnv *env;
+};
+
+int controlPlaneSubmit(ControlPlaneOp *op);
+int controlPlaneThreads();
+
+struct ControlPlane {
+  // Once per process
+  static void Start();
+  static void Init(Local<Object> exports);
+};
+
+typedef std::pair<libusb_device*, libusb_hotplug_event> HotplugEvent;
+
+void handleCompletion(Transfer *t);
+void handleStreamCompletion(StreamCompletion c);
+void handleRingWake(RingStream *ring);
+void handlePollerCompletion(Poller *poller);
+void handleChannelCompletion(OutBatch *batch);
+void handleControlCompletion(ControlRequest *req);
+void handleHotplug(HotplugEvent event);
+void handleControlPlaneDone(ControlPlaneOp *op);
+
+// Per-environment state. The main thread and every worker thread that loads
+// the addon get their own: devices are wrapped once per environment, and
+// completions are handed to the loop of the environment that started them.
+// An environment only ever runs on its own thread, so current() is a
+// thread-local lookup.
+struct UsbEnv {
+  Isolate *isolate;
+  uv_loop_t *loop;
+
+  // Map each libusb_device to a particular V8 instance
+  StdPersistentValueMap<libusb_device*, v8::Object> devices;
+  Nan::Persistent<FunctionTemplate> deviceConstructor;
+
+  // When a batch handler is installed, completed transfers are collected
+  // in batchPending and handed to JS by flushCompletions()
+  Nan::Persistent<Function> batchHandler;
+  std::vector<Transfer*> batchPending;
+
+  Nan::Persistent<Object> hotplugThis;
+  bool hotplugEnabled;
+  libusb_hotplug_callback_handle hotplugHandle;
+
+  // Channels whose timers run on this loop, closed along with it
+  std::set<OutChannel*> channels;
+
+  UVQueue<HotplugEvent> hotplugQueue;
+  UVQueue<ControlPlaneOp*> controlPlaneQueue;
+#ifndef USE_POLL
+  UVQueue<Transfer*> completionQueue;
+  UVQueue<StreamCompletion> streamQueue;
+  UVQueue<RingStream*> ringQueue;
+  UVQueue<OutBatch*> channelQueue;
+  UVQueue<ControlRequest*> controlQueue;
+  UVQueue<Poller*> pollerQueue;
+#endif
+  int closing;
+
+  UsbEnv(Isolate *isolate, uv_loop_t *loop);
+
+  // Environment of the calling thread, NULL once it has been torn down
+  static UsbEnv *current();
+
+  static void Init(Local<Object> exports);
+};
+
 struct PollBaton {
 public:
   bool active;
 
+  // A poll() is in flight, or its result hasn't been delivered yet
+  bool pending;
+
   libusb_device_handle *handle;
   unsigned char endpoint;
   int attributes;
@@ -87,15 +460,19 @@ public:
   int result;
   int errcode;
 
-  uv_work_t *req;
+  // Isochronous endpoints: packets per poll and [actual_length, status]
+  // for each of them
+  int isoPackets;
+  uint32_t *packets;
+
+  // Reused by every poll(), reallocated only when isoPackets changes
+  libusb_transfer *transfer;
 
   void reset() {
     buffer.Reset();
     data = 0;
     length = 0;
-
-    if (req) delete req;
-    req = 0;
+    pending = false;
 
     result = 0;
     errcode = 0;
@@ -105,9 +482,17 @@ public:
     reset();
     if (callback) delete callback;
     callback = 0;
+    free(packets);
+    packets = 0;
+    isoPackets = 0;
+    if (transfer) libusb_free_transfer(transfer);
+    transfer = 0;
   }
 };
 
+// Polls an endpoint with one asynchronous transfer, resubmitted on the
+// libusb event thread until it returns data, so a poller doesn't hold a
+// threadpool thread however long the endpoint stays idle.
 class Poller : public Nan::ObjectWrap {
 public:
   static void Init(Local<Object> exports);
@@ -120,20 +505,19 @@ public:
 
   PollBaton baton;
 
+  // Guards resubmission on the event thread against cancel()
+  uv_mutex_t mutex;
+
+  Device *device;
+
 private:
 
   Poller();
 
   ~Poller();
 
-//	int poll(int endpoint, int attributes, char *buffer, int len, Nan::Persistent<Function> callback);
-
 private:
   Nan::Persistent<v8::Object> This;
-
-  Device *device;
-
-  static Nan::Persistent<FunctionTemplate> constructor_template;
 };
 
 #define CHECK_USB(r) \
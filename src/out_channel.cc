@@ -0,0 +1,273 @@
+#include "node_usb.h"
+#include <string.h>
+
+extern "C" void LIBUSB_CALL channelCompletionCb(libusb_transfer *transfer);
+
+static UV_TIMER_CB(onChannelTimer);
+
+static void freeTimer(uv_handle_t* handle){
+	delete (uv_timer_t*) handle;
+}
+
+OutChannel::OutChannel(): device(NULL), current(NULL), inFlight(0), written(0),
+	timerActive(false), held(false) {
+	env = UsbEnv::current();
+	env->channels.insert(this);
+	timer = new uv_timer_t;
+	uv_timer_init(env->loop, timer);
+	timer->data = this;
+	DEBUG_LOG("Created OutChannel %p", this);
+}
+
+OutChannel::~OutChannel(){
+	DEBUG_LOG("Freed OutChannel %p", this);
+	if (current) idle.push_back(current);
+	for (size_t i = 0; i < idle.size(); i++) {
+		libusb_free_transfer(idle[i]->transfer);
+		free(idle[i]->data);
+		delete idle[i];
+	}
+	v8callback.Reset();
+	// Once the environment is gone it has closed the timer already
+	if (env) {
+		env->channels.erase(this);
+		uv_close((uv_handle_t*) timer, freeTimer);
+	}
+}
+
+// Close the timer along with the environment's loop
+void OutChannel::closeTimer(){
+	uv_close((uv_handle_t*) timer, freeTimer);
+	timer = NULL;
+	timerActive = false;
+	env = NULL;
+}
+
+// new OutChannel(device, endpointAddr, type, timeout, maxSize, delay, maxTransfers, callback)
+NAN_METHOD(OutChannel_constructor) {
+	ENTER_CONSTRUCTOR(8);
+	UNWRAP_ARG(Device, device, 0);
+	int endpoint, type, timeout, maxSize, delay, maxTransfers;
+	INT_ARG(endpoint, 1);
+	INT_ARG(type, 2);
+	INT_ARG(timeout, 3);
+	INT_ARG(maxSize, 4);
+	INT_ARG(delay, 5);
+	INT_ARG(maxTransfers, 6);
+	CALLBACK_ARG(7);
+
+	if (type != LIBUSB_TRANSFER_TYPE_BULK && type != LIBUSB_TRANSFER_TYPE_INTERRUPT){
+		THROW_BAD_ARGS("Writes can only be coalesced on bulk or interrupt endpoints");
+	}
+	if (maxSize <= 0 || delay < 0 || maxTransfers <= 0){
+		THROW_BAD_ARGS("Invalid size, delay or transfer count");
+	}
+
+	setConst(info.This(), "device", info[0]);
+	auto self = new OutChannel();
+	self->attach(info.This());
+	self->device = device;
+	self->endpoint = endpoint;
+	self->type = type;
+	self->timeout = timeout;
+	self->maxSize = maxSize;
+	self->delay = delay;
+	self->maxTransfers = maxTransfers;
+	self->v8callback.Reset(callback);
+
+	info.GetReturnValue().Set(info.This());
+}
+
+// Get an empty batch that can hold at least `length` bytes. Batches and
+// their buffers are recycled, so steady-state writes don't allocate.
+OutBatch* OutChannel::takeBatch(int length){
+	OutBatch* batch;
+	if (!idle.empty()) {
+		batch = idle.back();
+		idle.pop_back();
+	} else {
+		batch = new OutBatch;
+		batch->channel = this;
+		batch->transfer = libusb_alloc_transfer(0);
+		batch->transfer->callback = channelCompletionCb;
+		batch->transfer->user_data = batch;
+		batch->data = NULL;
+		batch->capacity = 0;
+	}
+
+	int capacity = length > maxSize ? length : maxSize;
+	if (batch->capacity < capacity) {
+		batch->data = (unsigned char*) realloc(batch->data, capacity);
+		batch->capacity = capacity;
+	}
+	batch->used = 0;
+	batch->writes = 0;
+	return batch;
+}
+
+// Close the current batch and send whatever there is capacity for
+void OutChannel::flush(){
+	if (timerActive) {
+		uv_timer_stop(timer);
+		timerActive = false;
+	}
+	if (current) {
+		ready.push_back(current);
+		current = NULL;
+	}
+	submitReady();
+}
+
+void OutChannel::submitReady(){
+	while (!ready.empty() && inFlight < maxTransfers) {
+		OutBatch* batch = ready.front();
+		ready.pop_front();
+
+		int r = LIBUSB_ERROR_NO_DEVICE;
+		if (device->device_handle) {
+			libusb_transfer* t = batch->transfer;
+			// Can't be cached as device could be closed and re-opened
+			t->dev_handle = device->device_handle;
+			t->endpoint = endpoint;
+			t->type = type;
+			t->timeout = timeout;
+			t->buffer = batch->data;
+			t->length = batch->used;
+			r = libusb_submit_transfer(t);
+		}
+
+		if (r < 0) {
+			completeBatch(batch, r);
+			continue;
+		}
+
+		inFlight++;
+		device->ref();
+		#ifndef USE_POLL
+		device->env->channelQueue.ref();
+		#endif
+	}
+	updateHold();
+}
+
+// Report a batch to JS and recycle it
+void OutChannel::completeBatch(OutBatch* batch, int errcode){
+	Nan::HandleScope scope;
+	int writes = batch->writes;
+	uint32_t first = batch->first;
+	batch->used = 0;
+	batch->writes = 0;
+	idle.push_back(batch);
+
+	Local<Value> error = Nan::Undefined();
+	if (errcode != 0) {
+		error = libusbException(errcode);
+	}
+	Local<Value> argv[] = {error, Nan::New<Uint32>(first), Nan::New<Uint32>((uint32_t) writes)};
+	Nan::TryCatch try_catch;
+	Nan::MakeCallback(handle(), Nan::New(v8callback), 3, argv);
+	if (try_catch.HasCaught()) {
+		Nan::FatalException(try_catch);
+	}
+}
+
+// Keep the JS object alive while any write is still pending
+void OutChannel::updateHold(){
+	bool busy = current || !ready.empty() || inFlight > 0;
+	if (busy && !held) {
+		Ref();
+		held = true;
+	} else if (!busy && held) {
+		held = false;
+		Unref();
+	}
+}
+
+// OutChannel.__write(buffer)
+NAN_METHOD(OutChannel_Write) {
+	ENTER_METHOD(OutChannel, 1);
+
+	if (!Buffer::HasInstance(info[0])){
+		THROW_BAD_ARGS("Buffer arg [0] must be Buffer");
+	}
+	if (!self->device->device_handle){
+		THROW_ERROR("Device is not open");
+	}
+	Local<Object> buffer = info[0]->ToObject();
+	int length = (int) Buffer::Length(buffer);
+
+	if (self->current && self->current->used + length > self->current->capacity) {
+		self->flush();
+	}
+	if (!self->current) {
+		self->current = self->takeBatch(length);
+	}
+
+	OutBatch* batch = self->current;
+	memcpy(batch->data + batch->used, Buffer::Data(buffer), length);
+	batch->used += length;
+	if (batch->writes++ == 0) {
+		batch->first = self->written;
+	}
+	self->written++;
+
+	if (batch->used >= self->maxSize) {
+		self->flush();
+	} else if (!self->timerActive) {
+		uv_timer_start(self->timer, onChannelTimer, self->delay, 0);
+		self->timerActive = true;
+		self->updateHold();
+	}
+
+	info.GetReturnValue().Set(Nan::Undefined());
+}
+
+// OutChannel.flush()
+NAN_METHOD(OutChannel_Flush) {
+	ENTER_METHOD(OutChannel, 0);
+	self->flush();
+	info.GetReturnValue().Set(Nan::Undefined());
+}
+
+static UV_TIMER_CB(onChannelTimer){
+	OutChannel* self = static_cast<OutChannel*>(handle->data);
+	self->timerActive = false;
+	self->flush();
+}
+
+extern "C" void LIBUSB_CALL channelCompletionCb(libusb_transfer *transfer){
+	OutBatch* batch = static_cast<OutBatch*>(transfer->user_data);
+	DEBUG_LOG("Channel completion %p", batch);
+
+	#ifdef USE_POLL
+	handleChannelCompletion(batch);
+	#else
+	batch->channel->device->env->channelQueue.post(batch);
+	#endif
+}
+
+void handleChannelCompletion(OutBatch* batch){
+	OutChannel* self = batch->channel;
+	DEBUG_LOG("HandleChannelCompletion %p %p", self, batch);
+
+	self->inFlight--;
+	self->device->unref();
+	#ifndef USE_POLL
+	self->device->env->channelQueue.unref();
+	#endif
+
+	int status = batch->transfer->status;
+	self->completeBatch(batch, status == LIBUSB_TRANSFER_COMPLETED ? 0 : status);
+	self->submitReady();
+}
+
+void OutChannel::Init(Local<Object> target){
+	Local<FunctionTemplate> tpl = Nan::New<FunctionTemplate>(OutChannel_constructor);
+	tpl->SetClassName(Nan::New("OutChannel").ToLocalChecked());
+	tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+	Nan::SetPrototypeMethod(tpl, "__write", OutChannel_Write);
+	Nan::SetPrototypeMethod(tpl, "flush", OutChannel_Flush);
+
+	target->Set(Nan::New("OutChannel").ToLocalChecked(), tpl->GetFunction());
+}
@@ -1,96 +1,121 @@
+#include <string.h>
 #include <libusb.h>
 #include "usb_ch9.h"
 #include "node_usb.h"
 
-Nan::Persistent<FunctionTemplate> Poller::constructor_template;
-
-void __eio_poll(uv_work_t *req) {
-  PollBaton *baton = static_cast<PollBaton *>(req->data);
-
-  baton->result = 0;
-
-  int rc = LIBUSB_SUCCESS;
-
-  while (baton->active) {
-    switch (baton->attributes & USB_ENDPOINT_XFERTYPE_MASK) {
-      case USB_ENDPOINT_XFER_CONTROL:
-      DEBUG_LOG("Can't send on a control endpoint.");
-        break;
-      case USB_ENDPOINT_XFER_ISOC:
-        //TODO handle isochronous
-      DEBUG_LOG("Isochronous endpoints unhandled.");
-        break;
-      case USB_ENDPOINT_XFER_BULK:
-        rc = libusb_bulk_transfer(baton->handle, baton->endpoint, baton->data, baton->length, &baton->result,
-                                  baton->timeout);
-        if (rc == LIBUSB_SUCCESS && baton->result) {
-          DEBUG_LOG("received bulk msg (%d bytes)", baton->result);
-        }
-        break;
-      case USB_ENDPOINT_XFER_INT:
-        rc = libusb_interrupt_transfer(baton->handle, baton->endpoint, baton->data, baton->length, &baton->result,
-                                       baton->timeout);
-        if (rc == LIBUSB_SUCCESS && baton->result) {
-          DEBUG_LOG("received interrupt msg (%d bytes)", baton->result);
-        }
-        break;
-      default:;
+static void LIBUSB_CALL poller_cb(libusb_transfer *transfer) {
+  Poller *self = static_cast<Poller *>(transfer->user_data);
+  PollBaton *baton = &self->baton;
+
+  int result = 0;
+  if (transfer->type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS) {
+    for (int i = 0; i < transfer->num_iso_packets; i++) {
+      baton->packets[2 * i] = transfer->iso_packet_desc[i].actual_length;
+      baton->packets[2 * i + 1] = transfer->iso_packet_desc[i].status;
+      result += transfer->iso_packet_desc[i].actual_length;
     }
-    baton->errcode = rc;
-    if (rc != LIBUSB_SUCCESS && rc != LIBUSB_ERROR_TIMEOUT) {
-      baton->result = 0;
-      DEBUG_LOG("Transfer error on EP%02x (xfertype %d): %s", baton->endpoint & 0xFF,
-                unsigned(baton->attributes & USB_ENDPOINT_XFERTYPE_MASK), libusb_strerror((libusb_error) rc));
-      break;
+  } else {
+    result = transfer->actual_length;
+  }
+
+  // Same mapping as libusb's synchronous bulk/interrupt helpers. A
+  // cancelled poll reports whatever it got, so JS sees it end cleanly.
+  int rc;
+  switch (transfer->status) {
+    case LIBUSB_TRANSFER_COMPLETED: rc = LIBUSB_SUCCESS; break;
+    case LIBUSB_TRANSFER_CANCELLED: rc = LIBUSB_SUCCESS; break;
+    case LIBUSB_TRANSFER_TIMED_OUT: rc = LIBUSB_ERROR_TIMEOUT; break;
+    case LIBUSB_TRANSFER_STALL: rc = LIBUSB_ERROR_PIPE; break;
+    case LIBUSB_TRANSFER_OVERFLOW: rc = LIBUSB_ERROR_OVERFLOW; break;
+    case LIBUSB_TRANSFER_NO_DEVICE: rc = LIBUSB_ERROR_NO_DEVICE; break;
+    default: rc = LIBUSB_ERROR_IO;
+  }
+
+  // Keep polling until there is data: timeouts and empty transfers are
+  // resubmitted here rather than reported. Submitting under the lock keeps
+  // cancel() from missing the transfer.
+  uv_mutex_lock(&self->mutex);
+  if (baton->active && result == 0 && (rc == LIBUSB_SUCCESS || rc == LIBUSB_ERROR_TIMEOUT)) {
+    rc = libusb_submit_transfer(transfer);
+    if (rc == LIBUSB_SUCCESS) {
+      uv_mutex_unlock(&self->mutex);
+      return;
     }
-    if (baton->result) break;
   }
+  uv_mutex_unlock(&self->mutex);
+
+  if (rc != LIBUSB_SUCCESS && rc != LIBUSB_ERROR_TIMEOUT) {
+    result = 0;
+    DEBUG_LOG("Transfer error on EP%02x (xfertype %d): %s", baton->endpoint & 0xFF,
+              unsigned(baton->attributes & USB_ENDPOINT_XFERTYPE_MASK), libusb_strerror((libusb_error) rc));
+  } else if (result) {
+    DEBUG_LOG("received msg on EP%02x (%d bytes)", baton->endpoint & 0xFF, result);
+  }
+  baton->result = result;
+  baton->errcode = rc;
+
+#ifdef USE_POLL
+  handlePollerCompletion(self);
+#else
+  self->device->env->pollerQueue.post(self);
+#endif
 }
 
-void __eio_poll_done(uv_work_t *req, int status) {
+void handlePollerCompletion(Poller *self) {
+  PollBaton *baton = &self->baton;
   Nan::HandleScope scope;
 
-  PollBaton *baton = static_cast<PollBaton *>(req->data);
+  self->device->unref();
+#ifndef USE_POLL
+  self->device->env->pollerQueue.unref();
+#endif
 
-  if (status == UV_ECANCELED) {
-    DEBUG_LOG("Pollation of %p cancelled", req->data);
-  } else {
-    DEBUG_LOG("poll done (device: %p, endpoint: %d, result: %d)", baton->handle, baton->endpoint, baton->result);
-
-    if (!baton->callback->IsEmpty()) {
-      Local<Value> error = Nan::Undefined();
-      if (baton->errcode != 0) {
-        error = libusbException(baton->errcode);
-      }
-      Local<Object> buffer = Nan::New<Object>(baton->buffer);
+  DEBUG_LOG("poll done (device: %p, endpoint: %d, result: %d)", baton->handle, baton->endpoint, baton->result);
 
-      Local<Value> argv[] = {error, buffer, Nan::New(baton->result)};
+  if (!baton->callback->IsEmpty()) {
+    Local<Value> error = Nan::Undefined();
+    if (baton->errcode != 0) {
+      error = libusbException(baton->errcode);
+    }
+    Local<Object> buffer = Nan::New<Object>(baton->buffer);
+
+    Local<Value> packets = Nan::Undefined();
+    if (baton->isoPackets) {
+      size_t size = baton->isoPackets * 2 * sizeof(uint32_t);
+      Local<ArrayBuffer> ab = ArrayBuffer::New(Isolate::GetCurrent(), size);
+      Local<Uint32Array> arr = Uint32Array::New(ab, 0, baton->isoPackets * 2);
+      Nan::TypedArrayContents<uint32_t> contents(arr);
+      memcpy(*contents, baton->packets, size);
+      packets = arr;
+    }
 
-      // reset baton before callback for poll in callback
-      baton->reset();
+    Local<Value> argv[] = {error, buffer, Nan::New(baton->result), packets};
 
-      DEBUG_LOG("call poll callback");
-      Nan::TryCatch try_catch;
-      baton->callback->Call(3, argv);
-      if (try_catch.HasCaught()) {
-        Nan::FatalException(try_catch);
-      }
+    // reset baton before callback for poll in callback
+    baton->reset();
 
-      return;
+    DEBUG_LOG("call poll callback");
+    Nan::TryCatch try_catch;
+    baton->callback->Call(baton->isoPackets ? 4 : 3, argv);
+    if (try_catch.HasCaught()) {
+      Nan::FatalException(try_catch);
     }
+
+    return;
   }
 
   baton->reset();
-
 }
 
 Poller::Poller() {
+  uv_mutex_init(&mutex);
   DEBUG_LOG("Created Poller %p", this);
 }
 
 Poller::~Poller() {
   DEBUG_LOG("Freed Poller %p", this);
   baton.destory();
+  uv_mutex_destroy(&mutex);
 }
 
 // Poller(device, endpoint, attributes, timeout, callback)
@@ -127,7 +152,7 @@ NAN_METHOD(Poller::Poll) {
     THROW_ERROR("Device is not open");
   }
 
-  if (self->baton.req) {
+  if (self->baton.pending) {
     THROW_ERROR("Poller is already active");
   }
 
@@ -138,6 +163,46 @@ NAN_METHOD(Poller::Poll) {
 
   unsigned char *data = (unsigned char *) node::Buffer::Data(buffer);
   int length = (int) node::Buffer::Length(buffer);
+  int type = self->baton.attributes & USB_ENDPOINT_XFERTYPE_MASK;
+
+  if (type == USB_ENDPOINT_XFER_CONTROL) {
+    THROW_BAD_ARGS("Can't poll a control endpoint");
+  }
+
+  int isoPackets = 0, packetSize = 0;
+  if (type == USB_ENDPOINT_XFER_ISOC) {
+    packetSize = libusb_get_max_iso_packet_size(self->device->device, self->baton.endpoint);
+    CHECK_USB(packetSize);
+    isoPackets = length / packetSize;
+    if (isoPackets < 1) {
+      THROW_BAD_ARGS("Buffer must hold at least one isochronous packet");
+    }
+    if (isoPackets != self->baton.isoPackets) {
+      self->baton.packets = (uint32_t *) realloc(self->baton.packets, isoPackets * 2 * sizeof(uint32_t));
+    }
+    length = isoPackets * packetSize;
+  }
+
+  if (!self->baton.transfer || isoPackets != self->baton.isoPackets) {
+    if (self->baton.transfer) libusb_free_transfer(self->baton.transfer);
+    self->baton.transfer = libusb_alloc_transfer(isoPackets);
+    self->baton.isoPackets = isoPackets;
+  }
+
+  // The ch9 transfer type values are the ones libusb uses
+  libusb_transfer *t = self->baton.transfer;
+  t->dev_handle = self->device->device_handle;
+  t->endpoint = self->baton.endpoint;
+  t->type = (unsigned char) type;
+  t->timeout = self->baton.timeout;
+  t->buffer = data;
+  t->length = length;
+  t->num_iso_packets = isoPackets;
+  t->callback = poller_cb;
+  t->user_data = self;
+  if (isoPackets) {
+    libusb_set_iso_packet_lengths(t, packetSize);
+  }
 
   self->baton.active = true;
   self->baton.handle = self->device->device_handle;
@@ -145,10 +210,6 @@ NAN_METHOD(Poller::Poll) {
   self->baton.data = data;
   self->baton.length = length;
 
-  uv_work_t *req = new uv_work_t();
-  req->data = &self->baton;
-  self->baton.req = req;
-
   DEBUG_LOG(
     "Polling (device_handle: %p, device_handle: %p, endpoint: 0x%x, attributes: %i, timeout: %i, length: %i, buffer: %p)",
     self,
@@ -160,22 +221,33 @@ NAN_METHOD(Poller::Poll) {
     self->baton.data
   );
 
-  uv_queue_work(uv_default_loop(), req, __eio_poll, (uv_after_work_cb) __eio_poll_done);
+  int rc = libusb_submit_transfer(t);
+  if (rc < 0) {
+    self->baton.reset();
+    CHECK_USB(rc);
+  }
 
-  info.GetReturnValue().SetUndefined();
+  self->baton.pending = true;
+  self->device->ref();
+#ifndef USE_POLL
+  self->device->env->pollerQueue.ref();
+#endif
 
+  info.GetReturnValue().SetUndefined();
 }
 
 // cancel()
 NAN_METHOD(Poller::Cancel) {
   ENTER_METHOD(Poller, 0);
 
-  if (self->baton.req) { // not executed
-    int rc = uv_cancel((uv_req_t *) self->baton.req);
-    if (rc != 0) { // executing
-      self->baton.active = false;
-    }
+  // The transfer may be between completion and resubmission; with active
+  // cleared it won't be resubmitted
+  uv_mutex_lock(&self->mutex);
+  self->baton.active = false;
+  if (self->baton.pending) {
+    libusb_cancel_transfer(self->baton.transfer);
   }
+  uv_mutex_unlock(&self->mutex);
 
   info.GetReturnValue().SetUndefined();
 }
@@ -189,6 +261,5 @@ void Poller::Init(Local<Object> target) {
   Nan::SetPrototypeMethod(tpl, "poll", Poll);
   Nan::SetPrototypeMethod(tpl, "cancel", Cancel);
 
-  constructor_template.Reset(tpl);
   target->Set(Nan::New("Poller").ToLocalChecked(), tpl->GetFunction());
 }
@@ -4,10 +4,12 @@
 
 #define EXTERNAL_NEW(x) External::New(Isolate::GetCurrent(), x)
 #define UV_ASYNC_CB(x) void x(uv_async_t *handle)
+#define UV_TIMER_CB(x) void x(uv_timer_t *handle)
 
 #else
 
 #define EXTERNAL_NEW(x) External::New(x)
 #define UV_ASYNC_CB(x) void x(uv_async_t *handle, int status)
+#define UV_TIMER_CB(x) void x(uv_timer_t *handle, int status)
 
 #endif
\ No newline at end of file
@@ -0,0 +1,421 @@
+#include "node_usb.h"
+#include "device_index.h"
+#include <stdio.h>
+#include <string.h>
+
+// Process-wide index of attached devices. Where libusb supports hotplug it
+// is filled once by an enumerating hotplug callback and kept current by
+// the same callback on event thread 0, so lookups never rescan the bus.
+// Elsewhere it is brought up to date from libusb_get_device_list() before
+// each lookup.
+//
+// Each entry also caches the string descriptors read from the device, so
+// they are forgotten when it is detached and read afresh when it returns.
+
+extern libusb_context* usb_context;
+
+static uv_once_t registryOnce = UV_ONCE_INIT;
+static uv_mutex_t registryLock;
+static DeviceIndex registry;
+static bool registryLive;
+static libusb_hotplug_callback_handle registryHandle;
+
+#define MAX_PORTS 7
+
+// Everything here comes from descriptors libusb keeps in memory
+static DeviceInfo* describeDevice(libusb_device* dev){
+	struct libusb_device_descriptor dd;
+	if (libusb_get_device_descriptor(dev, &dd) < 0) return NULL;
+
+	DeviceInfo* info = new DeviceInfo();
+	info->device = dev;
+	info->idVendor = dd.idVendor;
+	info->idProduct = dd.idProduct;
+	info->iSerialNumber = dd.iSerialNumber;
+	info->serialKnown = dd.iSerialNumber == 0;
+
+	uint8_t ports[MAX_PORTS];
+	int n = libusb_get_port_numbers(dev, ports, MAX_PORTS);
+	char part[8];
+	snprintf(part, sizeof(part), "%u", (unsigned) libusb_get_bus_number(dev));
+	info->path = part;
+	for (int i = 0; i < n; i++) {
+		snprintf(part, sizeof(part), i == 0 ? "-%u" : ".%u", (unsigned) ports[i]);
+		info->path += part;
+	}
+
+	info->classes.push_back(dd.bDeviceClass);
+	libusb_config_descriptor* config;
+	if (dd.bNumConfigurations && libusb_get_config_descriptor(dev, 0, &config) == LIBUSB_SUCCESS) {
+		for (int i = 0; i < config->bNumInterfaces; i++) {
+			for (int j = 0; j < config->interface[i].num_altsetting; j++) {
+				info->classes.push_back(config->interface[i].altsetting[j].bInterfaceClass);
+			}
+		}
+		libusb_free_config_descriptor(config);
+	}
+	return info;
+}
+
+static void addDevice(libusb_device* dev){
+	DeviceInfo* info = describeDevice(dev);
+	if (!info) return;
+	uv_mutex_lock(&registryLock);
+	bool added = registry.add(info);
+	uv_mutex_unlock(&registryLock);
+	if (added) {
+		libusb_ref_device(dev);
+	} else {
+		delete info;
+	}
+}
+
+static void removeDevice(libusb_device* dev){
+	uv_mutex_lock(&registryLock);
+	DeviceInfo* info = registry.remove(dev);
+	uv_mutex_unlock(&registryLock);
+	if (info) {
+		libusb_unref_device(dev);
+		delete info;
+	}
+}
+
+int LIBUSB_CALL registryHotplug(libusb_context *ctx, libusb_device *dev,
+                     libusb_hotplug_event event, void *user_data) {
+	if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) {
+		addDevice(dev);
+	} else if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT) {
+		removeDevice(dev);
+	}
+	return 0;
+}
+
+static void startRegistry(){
+	uv_mutex_init(&registryLock);
+	if (libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+		// ENUMERATE calls back for every device already attached before
+		// this returns
+		registryLive = libusb_hotplug_register_callback(usb_context,
+			(libusb_hotplug_event)(LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT),
+			LIBUSB_HOTPLUG_ENUMERATE, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+			registryHotplug, NULL, &registryHandle) == LIBUSB_SUCCESS;
+	}
+}
+
+// Without hotplug, rescan: drop devices that are gone and add new ones
+static int refreshRegistry(){
+	libusb_device **devs;
+	int cnt = libusb_get_device_list(usb_context, &devs);
+	if (cnt < 0) return cnt;
+
+	std::set<void*> present(devs, devs + cnt);
+	DeviceIndex::List known;
+	std::vector<void*> gone;
+	uv_mutex_lock(&registryLock);
+	registry.all(known);
+	for (size_t i = 0; i < known.size(); i++) {
+		if (!present.count(known[i]->device)) gone.push_back(known[i]->device);
+	}
+	uv_mutex_unlock(&registryLock);
+	for (size_t i = 0; i < gone.size(); i++) {
+		removeDevice((libusb_device*) gone[i]);
+	}
+	for (int i = 0; i < cnt; i++) {
+		addDevice(devs[i]);
+	}
+	libusb_free_device_list(devs, true);
+	return LIBUSB_SUCCESS;
+}
+
+// Read the serial numbers nobody has asked for yet. Runs on a control-plane
+// thread, as opening every device can take a while. The registry lock isn't
+// held while devices are opened, so hotplug events aren't held up.
+static void resolveSerials(){
+	DeviceIndex::List pending;
+	std::vector<libusb_device*> devs;
+	std::vector<uint8_t> index;
+	uv_mutex_lock(&registryLock);
+	registry.unknownSerials(pending);
+	for (size_t i = 0; i < pending.size(); i++) {
+		libusb_device* dev = (libusb_device*) pending[i]->device;
+		libusb_ref_device(dev);
+		devs.push_back(dev);
+		index.push_back(pending[i]->iSerialNumber);
+	}
+	uv_mutex_unlock(&registryLock);
+
+	for (size_t i = 0; i < devs.size(); i++) {
+		// A device that can't be read (e.g. no permission) has no serial
+		// as far as lookups are concerned, and isn't tried again
+		std::string serial;
+		libusb_device_handle* handle;
+		if (libusb_open(devs[i], &handle) == LIBUSB_SUCCESS) {
+			unsigned char buf[256];
+			int r = libusb_get_string_descriptor_ascii(handle, index[i], buf, sizeof(buf));
+			if (r > 0) serial.assign((char*) buf, r);
+			libusb_close(handle);
+		}
+
+		uv_mutex_lock(&registryLock);
+		DeviceInfo* info = registry.get(devs[i]);
+		if (info && !info->serialKnown) {
+			registry.setSerial(info, serial);
+		}
+		uv_mutex_unlock(&registryLock);
+		libusb_unref_device(devs[i]);
+	}
+}
+
+// Without hotplug a device may not have been seen by a lookup yet
+static void track(libusb_device* dev){
+	uv_once(&registryOnce, startRegistry);
+	if (!registryLive) {
+		uv_mutex_lock(&registryLock);
+		bool known = registry.get(dev) != NULL;
+		uv_mutex_unlock(&registryLock);
+		if (!known) addDevice(dev);
+	}
+}
+
+static uint32_t stringKey(uint8_t index, uint16_t langid){
+	return ((uint32_t) langid << 8) | index;
+}
+
+// Length of a descriptor of `type` as sent, or -1 if it isn't one
+static int descriptorLength(const unsigned char* desc, int length, uint8_t type){
+	if (length < 2 || desc[1] != type || desc[0] < 2) return -1;
+	return desc[0] < length ? desc[0] : length;
+}
+
+static void utf16ToUtf8(const unsigned char* p, int units, std::string& out){
+	for (int i = 0; i < units; i++) {
+		uint32_t c = p[2 * i] | (p[2 * i + 1] << 8);
+		if (c >= 0xd800 && c < 0xdc00 && i + 1 < units) {
+			uint32_t low = p[2 * i + 2] | (p[2 * i + 3] << 8);
+			if (low >= 0xdc00 && low < 0xe000) {
+				c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+				i++;
+			}
+		}
+		if (c < 0x80) {
+			out += (char) c;
+		} else if (c < 0x800) {
+			out += (char) (0xc0 | (c >> 6));
+			out += (char) (0x80 | (c & 0x3f));
+		} else if (c < 0x10000) {
+			out += (char) (0xe0 | (c >> 12));
+			out += (char) (0x80 | ((c >> 6) & 0x3f));
+			out += (char) (0x80 | (c & 0x3f));
+		} else {
+			out += (char) (0xf0 | (c >> 18));
+			out += (char) (0x80 | ((c >> 12) & 0x3f));
+			out += (char) (0x80 | ((c >> 6) & 0x3f));
+			out += (char) (0x80 | (c & 0x3f));
+		}
+	}
+}
+
+bool Registry::getString(libusb_device* dev, uint8_t index, uint16_t langid, std::string& out){
+	track(dev);
+	uv_mutex_lock(&registryLock);
+	DeviceInfo* info = registry.get(dev);
+	bool found = false;
+	if (info) {
+		auto it = info->strings.find(stringKey(index, langid));
+		if (it != info->strings.end()) {
+			out = it->second;
+			found = true;
+		}
+	}
+	uv_mutex_unlock(&registryLock);
+	return found;
+}
+
+bool Registry::getLangids(libusb_device* dev, std::vector<uint16_t>& out){
+	track(dev);
+	uv_mutex_lock(&registryLock);
+	DeviceInfo* info = registry.get(dev);
+	bool found = info && info->langidsKnown;
+	if (found) out = info->langids;
+	uv_mutex_unlock(&registryLock);
+	return found;
+}
+
+bool Registry::putStringDescriptor(libusb_device* dev, uint8_t index, uint16_t langid,
+		const unsigned char* desc, int length, std::string& out){
+	length = descriptorLength(desc, length, LIBUSB_DT_STRING);
+	if (length < 0) return false;
+	out.clear();
+	utf16ToUtf8(desc + 2, (length - 2) / 2, out);
+
+	track(dev);
+	uv_mutex_lock(&registryLock);
+	DeviceInfo* info = registry.get(dev);
+	if (info) {
+		info->strings[stringKey(index, langid)] = out;
+		// The serial number in the first language is the one lookups use, so
+		// a read by getStringDescriptor() or enumerate() saves opening the
+		// device again later
+		if (!info->serialKnown && index == info->iSerialNumber && info->langidsKnown
+				&& langid == (info->langids.empty() ? 0x0409 : info->langids[0])) {
+			registry.setSerial(info, out);
+		}
+	}
+	uv_mutex_unlock(&registryLock);
+	return true;
+}
+
+bool Registry::putLangids(libusb_device* dev, const unsigned char* desc, int length,
+		std::vector<uint16_t>& out){
+	length = descriptorLength(desc, length, LIBUSB_DT_STRING);
+	if (length < 0) return false;
+	out.clear();
+	for (int i = 2; i + 1 < length; i += 2) {
+		out.push_back((uint16_t) (desc[i] | (desc[i + 1] << 8)));
+	}
+
+	track(dev);
+	uv_mutex_lock(&registryLock);
+	DeviceInfo* info = registry.get(dev);
+	if (info) {
+		info->langids = out;
+		info->langidsKnown = true;
+	}
+	uv_mutex_unlock(&registryLock);
+	return true;
+}
+
+// Called with registryLock held. The references keep the devices alive
+// across Device::get() after the lock is dropped, even if they are detached.
+static void refDevices(const DeviceIndex::List& found, std::vector<libusb_device*>& devs){
+	for (size_t i = 0; i < found.size(); i++) {
+		libusb_device* dev = (libusb_device*) found[i]->device;
+		libusb_ref_device(dev);
+		devs.push_back(dev);
+	}
+}
+
+// _findDevices(first, kind, key[, key2]): Devices matching a registry
+// lookup, only the first match if `first` is set. kind is 'ids'
+// (idVendor, idProduct), 'serial', 'path' or 'class'. Serial lookups only
+// see the serial numbers read so far; see _resolveSerials().
+NAN_METHOD(FindDevices) {
+	Nan::HandleScope scope;
+	if (info.Length() < 3 || !info[0]->IsBoolean()) {
+		THROW_BAD_ARGS("Expected first, a lookup kind and key");
+	}
+	size_t limit = info[0]->BooleanValue() ? 1 : (size_t) -1;
+	Nan::Utf8String kind(info[1]);
+
+	int vid = 0, pid = 0, cls = 0;
+	std::string key;
+	if (strcmp(*kind, "ids") == 0) {
+		INT_ARG(vid, 2);
+		INT_ARG(pid, 3);
+	} else if (strcmp(*kind, "class") == 0) {
+		INT_ARG(cls, 2);
+	} else if (strcmp(*kind, "serial") == 0 || strcmp(*kind, "path") == 0) {
+		Nan::Utf8String s(info[2]);
+		key.assign(*s, s.length());
+	} else {
+		THROW_BAD_ARGS("Lookup kind must be 'ids', 'serial', 'path' or 'class'");
+	}
+
+	uv_once(&registryOnce, startRegistry);
+	if (!registryLive) {
+		CHECK_USB(refreshRegistry());
+	}
+
+	DeviceIndex::List found;
+	std::vector<libusb_device*> devs;
+	uv_mutex_lock(&registryLock);
+	if (strcmp(*kind, "ids") == 0) {
+		registry.findByIds((uint16_t) vid, (uint16_t) pid, found, limit);
+	} else if (strcmp(*kind, "class") == 0) {
+		registry.findByClass((uint8_t) cls, found, limit);
+	} else if (strcmp(*kind, "serial") == 0) {
+		registry.findBySerial(key, found, limit);
+	} else {
+		DeviceInfo* match = registry.findByPath(key);
+		if (match) found.push_back(match);
+	}
+	refDevices(found, devs);
+	uv_mutex_unlock(&registryLock);
+
+	Local<Array> arr = Nan::New<Array>((int) devs.size());
+	for (size_t i = 0; i < devs.size(); i++) {
+		arr->Set(i, Device::get(devs[i]));
+		libusb_unref_device(devs[i]);
+	}
+	info.GetReturnValue().Set(arr);
+}
+
+struct SerialJob {
+	uv_work_t req;
+	ControlPlaneOp op;
+	int errcode;
+	Nan::Persistent<Function> callback;
+
+	SerialJob(): errcode(0) {}
+
+	~SerialJob(){
+		callback.Reset();
+	}
+};
+
+static void serialWork(uv_work_t* req){
+	auto job = (SerialJob*) req->data;
+	if (!registryLive) {
+		job->errcode = refreshRegistry();
+		if (job->errcode < 0) return;
+	}
+	resolveSerials();
+}
+
+static void serialDone(uv_work_t* req, int){
+	Nan::HandleScope scope;
+	auto job = (SerialJob*) req->data;
+	Local<Value> argv[1] = {Nan::Undefined()};
+	if (job->errcode < 0) {
+		argv[0] = libusbException(job->errcode);
+	}
+	Local<Function> callback = Nan::New(job->callback);
+	delete job;
+
+	Nan::TryCatch try_catch;
+	Nan::MakeCallback(Nan::GetCurrentContext()->Global(), callback, 1, argv);
+	if (try_catch.HasCaught()) {
+		Nan::FatalException(try_catch);
+	}
+}
+
+// _resolveSerials(callback(error)): read the serial numbers of devices not
+// looked up by serial yet, off the JS thread
+NAN_METHOD(ResolveSerials) {
+	Nan::HandleScope scope;
+	CHECK_N_ARGS(1);
+	CALLBACK_ARG(0);
+	uv_once(&registryOnce, startRegistry);
+
+	auto job = new SerialJob();
+	job->callback.Reset(callback);
+	job->req.data = job;
+	job->op.req = &job->req;
+	job->op.work = serialWork;
+	job->op.after = serialDone;
+	// Shares the lane of enumerate()'s bus scans
+	job->op.device = NULL;
+	job->op.env = UsbEnv::current();
+
+	int r = controlPlaneSubmit(&job->op);
+	if (r < 0) {
+		delete job;
+		CHECK_USB(r);
+	}
+	info.GetReturnValue().Set(Nan::Undefined());
+}
+
+void Registry::Init(Local<Object> target){
+	Nan::SetMethod(target, "_findDevices", FindDevices);
+	Nan::SetMethod(target, "_resolveSerials", ResolveSerials);
+}
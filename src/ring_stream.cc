@@ -0,0 +1,329 @@
+#include "node_usb.h"
+
+extern "C" void LIBUSB_CALL ringCompletionCb(libusb_transfer *transfer);
+
+RingStream::RingStream(): device(NULL), scratch(NULL), header(NULL), data(NULL), slots(0), slotSize(0),
+	running(false), head(0), next(0), active(false), inFlight(0), queued(0), error(0),
+	completed(0), overruns(0) {
+	uv_mutex_init(&mutex);
+	DEBUG_LOG("Created RingStream %p", this);
+}
+
+RingStream::~RingStream(){
+	DEBUG_LOG("Freed RingStream %p", this);
+	for (size_t i = 0; i < transfers.size(); i++) {
+		libusb_free_transfer(transfers[i]);
+	}
+	free(scratch);
+	v8sab.Reset();
+	v8notify.Reset();
+	v8end.Reset();
+	uv_mutex_destroy(&mutex);
+}
+
+// new RingStream(device, endpointAddr, type, timeout, slotSize, slots, nTransfers, sab, notify, end)
+NAN_METHOD(RingStream_constructor) {
+	ENTER_CONSTRUCTOR(10);
+	UNWRAP_ARG(Device, device, 0);
+	int endpoint, type, timeout, slotSize, slots, nTransfers;
+	INT_ARG(endpoint, 1);
+	INT_ARG(type, 2);
+	INT_ARG(timeout, 3);
+	INT_ARG(slotSize, 4);
+	INT_ARG(slots, 5);
+	INT_ARG(nTransfers, 6);
+	if (!info[7]->IsSharedArrayBuffer()){
+		THROW_BAD_ARGS("Arg [7] must be a SharedArrayBuffer");
+	}
+	if (!info[8]->IsFunction() || !info[9]->IsFunction()){
+		THROW_BAD_ARGS("Callback args [8] and [9] must be functions");
+	}
+	if (type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS){
+		THROW_BAD_ARGS("Isochronous endpoints are not supported");
+	}
+
+	// Slot numbers are sequence numbers modulo `slots`, which only stays
+	// consistent across the 32-bit wrap for a power of two
+	if (slotSize <= 0 || nTransfers <= 0 || slots <= 0 || (slots & (slots - 1)) != 0){
+		THROW_BAD_ARGS("Slot size and transfer count must be positive, slot count a power of two");
+	}
+	Local<SharedArrayBuffer> sab = Local<SharedArrayBuffer>::Cast(info[7]);
+	SharedArrayBuffer::Contents contents = sab->GetContents();
+	size_t offset = ringDataOffset(slots);
+	if (contents.ByteLength() < offset + (size_t) slots * slotSize){
+		THROW_BAD_ARGS("SharedArrayBuffer is too small for the ring");
+	}
+
+	setConst(info.This(), "device", info[0]);
+	setConst(info.This(), "buffer", info[7]);
+	auto self = new RingStream();
+	self->attach(info.This());
+	self->device = device;
+	self->v8sab.Reset(sab);
+	self->header = (int32_t*) contents.Data();
+	self->data = (unsigned char*) contents.Data() + offset;
+	self->slots = slots;
+	self->slotSize = slotSize;
+	self->ready.assign(slots, false);
+	self->scratch = (unsigned char*) malloc(slotSize);
+	self->v8notify.Reset(Local<Function>::Cast(info[8]));
+	self->v8end.Reset(Local<Function>::Cast(info[9]));
+
+	self->header[RING_SLOTS] = slots;
+	self->header[RING_SLOT_SIZE] = slotSize;
+
+	for (int i = 0; i < nTransfers; i++) {
+		libusb_transfer* t = libusb_alloc_transfer(0);
+		t->endpoint = endpoint;
+		t->type = type;
+		t->timeout = timeout;
+		t->length = slotSize;
+		t->callback = ringCompletionCb;
+		t->user_data = self;
+		self->transfers.push_back(t);
+	}
+
+	info.GetReturnValue().Set(info.This());
+}
+
+// Submit t into the next ring slot, or into the scratch buffer if the
+// consumer hasn't freed one. Called with mutex held. Scratch data is thrown
+// away, so every transfer may share the one buffer.
+int RingStream::arm(libusb_transfer* t){
+	uint32_t tail = (uint32_t) word(RING_TAIL).load();
+	bool toRing = next - tail < (uint32_t) slots;
+	t->buffer = toRing ? slotData(next & (slots - 1)) : scratch;
+	int r = libusb_submit_transfer(t);
+	if (r == LIBUSB_SUCCESS && toRing) {
+		next++;
+	}
+	return r;
+}
+
+// Called with mutex held
+void RingStream::cancel(){
+	for (size_t i = 0; i < transfers.size(); i++) {
+		libusb_cancel_transfer(transfers[i]);
+	}
+}
+
+// RingStream.start()
+NAN_METHOD(RingStream_Start) {
+	ENTER_METHOD(RingStream, 0);
+
+	if (self->running){
+		THROW_ERROR("Ring is already active")
+	}
+	if (!self->device->device_handle){
+		THROW_ERROR("Device is not open");
+	}
+
+	uv_mutex_lock(&self->mutex);
+	self->head = self->next = 0;
+	self->ready.assign(self->slots, false);
+	self->error = 0;
+	self->word(RING_HEAD).store(0);
+	self->word(RING_TAIL).store(0);
+	self->word(RING_OVERRUNS).store(0);
+	self->word(RING_WAITING).store(0);
+	self->word(RING_ERROR).store(0);
+	self->word(RING_STATE).store(1);
+	self->active = true;
+
+	int r = LIBUSB_SUCCESS;
+	for (size_t i = 0; i < self->transfers.size(); i++) {
+		libusb_transfer* t = self->transfers[i];
+		// Can't be cached in constructor as device could be closed and re-opened
+		t->dev_handle = self->device->device_handle;
+		r = self->arm(t);
+		if (r < 0) break;
+		self->inFlight++;
+	}
+
+	if (r < 0) {
+		self->active = false;
+		self->cancel();
+	}
+	bool idle = self->inFlight == 0;
+	uv_mutex_unlock(&self->mutex);
+
+	if (!idle) {
+		// Keep everything alive until finish()
+		self->running = true;
+		self->ref();
+		self->device->ref();
+		#ifndef USE_POLL
+		self->device->env->ringQueue.ref();
+		#endif
+	} else {
+		self->word(RING_STATE).store(0);
+	}
+
+	CHECK_USB(r);
+	info.GetReturnValue().Set(info.This());
+}
+
+// RingStream.stop()
+NAN_METHOD(RingStream_Stop) {
+	ENTER_METHOD(RingStream, 0);
+
+	uv_mutex_lock(&self->mutex);
+	self->active = false;
+	self->cancel();
+	bool done = self->inFlight == 0 && self->queued == 0;
+	uv_mutex_unlock(&self->mutex);
+
+	if (done) {
+		self->finish();
+	}
+	info.GetReturnValue().Set(info.This());
+}
+
+// RingStream.stats()
+NAN_METHOD(RingStream_Stats) {
+	ENTER_METHOD(RingStream, 0);
+	Local<Object> stats = Nan::New<Object>();
+
+	uv_mutex_lock(&self->mutex);
+	stats->Set(V8STR("completed"), Nan::New<Number>(self->completed));
+	stats->Set(V8STR("overruns"), Nan::New<Number>(self->overruns));
+	stats->Set(V8STR("inFlight"), Nan::New<Uint32>((uint32_t) self->inFlight));
+	stats->Set(V8STR("published"), Nan::New<Uint32>(self->head));
+	uv_mutex_unlock(&self->mutex);
+
+	info.GetReturnValue().Set(stats);
+}
+
+extern "C" void LIBUSB_CALL ringCompletionCb(libusb_transfer *transfer){
+	RingStream* s = static_cast<RingStream*>(transfer->user_data);
+	DEBUG_LOG("Ring completion %p", s);
+
+	bool hasData = transfer->status == LIBUSB_TRANSFER_COMPLETED
+		|| transfer->status == LIBUSB_TRANSFER_TIMED_OUT;
+	int length = hasData ? transfer->actual_length : 0;
+	bool wake = false;
+
+	uv_mutex_lock(&s->mutex);
+	s->completed++;
+
+	int slot = s->slotOf(transfer);
+	if (slot >= 0) {
+		// Publish in sequence order, whatever order transfers complete in.
+		// Failed or cancelled transfers publish an empty slot.
+		s->header[RING_HEADER_WORDS + slot] = length;
+		s->ready[slot] = true;
+		uint32_t head = s->head;
+		while (head != s->next && s->ready[head & (s->slots - 1)]) {
+			s->ready[head & (s->slots - 1)] = false;
+			head++;
+		}
+		if (head != s->head) {
+			s->head = head;
+			s->word(RING_HEAD).store((int32_t) head);
+			// The consumer sets RING_WAITING before sleeping on RING_HEAD
+			wake = s->word(RING_WAITING).exchange(0) != 0;
+		}
+	} else if (length > 0) {
+		s->overruns++;
+		s->word(RING_OVERRUNS).fetch_add(1);
+	}
+
+	int errcode = 0;
+	if (s->active && hasData) {
+		// libusb does not call back into us from libusb_submit_transfer, so
+		// submitting under the lock can't deadlock
+		errcode = s->arm(transfer);
+		if (errcode < 0) s->inFlight--;
+	} else {
+		s->inFlight--;
+		if (!hasData && transfer->status != LIBUSB_TRANSFER_CANCELLED) {
+			errcode = transfer->status;
+		}
+	}
+
+	if (errcode != 0 && s->active) {
+		// An error ends the ring rather than leaving it with fewer transfers
+		s->error = errcode;
+		s->word(RING_ERROR).store(errcode);
+		s->active = false;
+		s->cancel();
+	}
+
+	bool done = !s->active && s->inFlight == 0;
+	if (wake || done) s->queued++;
+	uv_mutex_unlock(&s->mutex);
+
+	if (wake || done) {
+		#ifdef USE_POLL
+		handleRingWake(s);
+		#else
+		s->device->env->ringQueue.post(s);
+		#endif
+	}
+}
+
+void RingStream::finish(){
+	if (!running) return;
+	running = false;
+	DEBUG_LOG("Ring finished %p", this);
+
+	Nan::HandleScope scope;
+	device->unref();
+	#ifndef USE_POLL
+	device->env->ringQueue.unref();
+	#endif
+
+	// Everything is published by now; a consumer that sees the state
+	// cleared has read all there is
+	word(RING_STATE).store(0);
+
+	Nan::TryCatch try_catch;
+	Nan::MakeCallback(handle(), Nan::New(v8notify), 0, NULL);
+	if (try_catch.HasCaught()) {
+		Nan::FatalException(try_catch);
+		try_catch.Reset();
+	}
+
+	Local<Value> argv[] = {error ? libusbException(error) : Nan::Undefined().As<Value>()};
+	Nan::MakeCallback(handle(), Nan::New(v8end), 1, argv);
+	if (try_catch.HasCaught()) {
+		Nan::FatalException(try_catch);
+	}
+
+	Unref();
+}
+
+// Wakes a sleeping consumer. Only the JS Atomics API can wake a thread
+// blocked in Atomics.wait(), so this runs on the loop of the environment
+// that started the ring, and only when the consumer said it was sleeping.
+void handleRingWake(RingStream* self){
+	Nan::HandleScope scope;
+	DEBUG_LOG("HandleRingWake %p", self);
+
+	Nan::TryCatch try_catch;
+	Nan::MakeCallback(self->handle(), Nan::New(self->v8notify), 0, NULL);
+	if (try_catch.HasCaught()) {
+		Nan::FatalException(try_catch);
+	}
+
+	uv_mutex_lock(&self->mutex);
+	self->queued--;
+	bool done = !self->active && self->inFlight == 0 && self->queued == 0;
+	uv_mutex_unlock(&self->mutex);
+
+	if (done) {
+		self->finish();
+	}
+}
+
+void RingStream::Init(Local<Object> target){
+	Local<FunctionTemplate> tpl = Nan::New<FunctionTemplate>(RingStream_constructor);
+	tpl->SetClassName(Nan::New("RingStream").ToLocalChecked());
+	tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+	Nan::SetPrototypeMethod(tpl, "start", RingStream_Start);
+	Nan::SetPrototypeMethod(tpl, "stop", RingStream_Stop);
+	Nan::SetPrototypeMethod(tpl, "stats", RingStream_Stats);
+
+	target->Set(Nan::New("RingStream").ToLocalChecked(), tpl->GetFunction());
+}
@@ -1,15 +1,14 @@
 #include "node_usb.h"
+#include "buffer_pool.h"
+#include <string.h>
+#include <vector>
 
 extern "C" void LIBUSB_CALL usbCompletionCb(libusb_transfer *transfer);
-void handleCompletion(Transfer* t);
+void deliverCompletion(Transfer* t);
 
-#ifndef USE_POLL
-#include "uv_async_queue.h"
-UVQueue<Transfer*> completionQueue(handleCompletion);
-#endif
-
-Transfer::Transfer(){
-	transfer = libusb_alloc_transfer(0);
+Transfer::Transfer(int isoPackets): pooled(NULL), pooledCapacity(0) {
+	transfer = libusb_alloc_transfer(isoPackets);
+	transfer->num_iso_packets = isoPackets;
 	transfer->callback = usbCompletionCb;
 	transfer->user_data = this;
 	DEBUG_LOG("Created Transfer %p", this);
@@ -18,10 +17,11 @@ Transfer::Transfer(){
 Transfer::~Transfer(){
 	DEBUG_LOG("Freed Transfer %p", this);
 	v8callback.Reset();
+	BufferPool::release(pooled, pooledCapacity);
 	libusb_free_transfer(transfer);
 }
 
-// new Transfer(device, endpointAddr, type, timeout)
+// new Transfer(device, endpointAddr, type, timeout, callback, [isoPackets])
 NAN_METHOD(Transfer_constructor) {
 	ENTER_CONSTRUCTOR(5);
 	UNWRAP_ARG(Device, device, 0);
@@ -30,9 +30,16 @@ NAN_METHOD(Transfer_constructor) {
 	INT_ARG(type, 2);
 	INT_ARG(timeout, 3);
 	CALLBACK_ARG(4);
+	int isoPackets = 0;
+	if (info.Length() > 5) {
+		INT_ARG(isoPackets, 5);
+	}
+	if (isoPackets < 0 || (isoPackets > 0 && type != LIBUSB_TRANSFER_TYPE_ISOCHRONOUS)) {
+		THROW_BAD_ARGS("Packet count is only valid for isochronous transfers");
+	}
 
 	setConst(info.This(), "device", info[0]);
-	auto self = new Transfer();
+	auto self = new Transfer(isoPackets);
 	self->attach(info.This());
 	self->device = device;
 	self->transfer->endpoint = endpoint;
@@ -44,18 +51,74 @@ NAN_METHOD(Transfer_constructor) {
 	info.GetReturnValue().Set(info.This());
 }
 
-// Transfer.submit(buffer, callback)
+// The submitted Buffer, or undefined for a gathered submit
+Local<Value> Transfer::transferBuffer(){
+	if (v8buffer.IsEmpty()) return Nan::Undefined();
+	return Nan::New<Object>(v8buffer);
+}
+
+void Transfer::releaseBuffer(){
+	v8buffer.Reset();
+	BufferPool::release(pooled, pooledCapacity);
+	pooled = NULL;
+	pooledCapacity = 0;
+	transfer->buffer = NULL;
+}
+
+// A new array per completion, so a callback may keep it
+Local<Value> Transfer::packetDescriptors(){
+	int n = transfer->num_iso_packets;
+	if (n == 0) return Nan::Undefined();
+
+	Local<ArrayBuffer> ab = ArrayBuffer::New(Isolate::GetCurrent(), n * 2 * sizeof(uint32_t));
+	Local<Uint32Array> packets = Uint32Array::New(ab, 0, n * 2);
+	Nan::TypedArrayContents<uint32_t> contents(packets);
+	uint32_t* out = *contents;
+	for (int i = 0; i < n; i++) {
+		out[2 * i] = transfer->iso_packet_desc[i].actual_length;
+		out[2 * i + 1] = transfer->iso_packet_desc[i].status;
+	}
+	return packets;
+}
+
+// Transfer.submit(buffer | [buffers...], [streamId])
 NAN_METHOD(Transfer_Submit) {
 	ENTER_METHOD(Transfer, 1);
 
+	// A stream id turns a bulk transfer into a bulk stream transfer on
+	// streams allocated with Device.__allocStreams
+	int type = self->transfer->type;
+	uint32_t streamId = 0;
+	if (info.Length() > 1 && !info[1]->IsUndefined()) {
+		if (!info[1]->IsUint32()){
+			THROW_BAD_ARGS("Stream id arg [1] must be an unsigned integer");
+		}
+		if (type != LIBUSB_TRANSFER_TYPE_BULK && type != LIBUSB_TRANSFER_TYPE_BULK_STREAM){
+			THROW_BAD_ARGS("Stream ids are only valid for bulk transfers");
+		}
+		streamId = info[1]->Uint32Value();
+	}
+
 	if (self->transfer->buffer){
 		THROW_ERROR("Transfer is already active")
 	}
 
-	if (!Buffer::HasInstance(info[0])){
+	// An array of Buffers is gathered into one pooled native buffer and
+	// sent as a single transfer. Only meaningful for OUT endpoints.
+	Local<Array> parts;
+	if (info[0]->IsArray()) {
+		if (self->transfer->endpoint & LIBUSB_ENDPOINT_IN){
+			THROW_BAD_ARGS("Buffer arrays can only be written to OUT endpoints");
+		}
+		parts = Local<Array>::Cast(info[0]);
+		for (uint32_t i = 0; i < parts->Length(); i++) {
+			if (!Buffer::HasInstance(parts->Get(i))){
+				THROW_BAD_ARGS("Buffer arg [0] must be Buffer or array of Buffers");
+			}
+		}
+	} else if (!Buffer::HasInstance(info[0])){
 		THROW_BAD_ARGS("Buffer arg [0] must be Buffer");
 	}
-	Local<Object> buffer_obj = info[0]->ToObject();
 	if (!self->device->device_handle){
 		THROW_ERROR("Device is not open");
 	}
@@ -63,15 +126,52 @@ NAN_METHOD(Transfer_Submit) {
 	// Can't be cached in constructor as device could be closed and re-opened
 	self->transfer->dev_handle = self->device->device_handle;
 
-	self->v8buffer.Reset(buffer_obj);
-	self->transfer->buffer = (unsigned char*) Buffer::Data(buffer_obj);
-	self->transfer->length = Buffer::Length(buffer_obj);
+	if (streamId) {
+		self->transfer->type = LIBUSB_TRANSFER_TYPE_BULK_STREAM;
+		libusb_transfer_set_stream_id(self->transfer, streamId);
+	} else if (type == LIBUSB_TRANSFER_TYPE_BULK_STREAM) {
+		self->transfer->type = LIBUSB_TRANSFER_TYPE_BULK;
+	}
+
+	if (parts.IsEmpty()) {
+		Local<Object> buffer_obj = info[0]->ToObject();
+		self->v8buffer.Reset(buffer_obj);
+		self->transfer->buffer = (unsigned char*) Buffer::Data(buffer_obj);
+		self->transfer->length = Buffer::Length(buffer_obj);
+	} else {
+		size_t length = 0;
+		for (uint32_t i = 0; i < parts->Length(); i++) {
+			length += Buffer::Length(parts->Get(i));
+		}
+		self->pooled = BufferPool::acquire(length, self->pooledCapacity);
+		size_t offset = 0;
+		for (uint32_t i = 0; i < parts->Length(); i++) {
+			Local<Value> part = parts->Get(i);
+			memcpy(self->pooled + offset, Buffer::Data(part), Buffer::Length(part));
+			offset += Buffer::Length(part);
+		}
+		self->transfer->buffer = self->pooled;
+		self->transfer->length = length;
+	}
+
+	if (self->transfer->num_iso_packets > 0) {
+		// Split evenly; only the last packet of an OUT transfer whose length
+		// is not a multiple of the packet count comes out short.
+		int n = self->transfer->num_iso_packets;
+		int packetSize = (self->transfer->length + n - 1) / n;
+		int remaining = self->transfer->length;
+		for (int i = 0; i < n; i++) {
+			int len = remaining < packetSize ? remaining : packetSize;
+			self->transfer->iso_packet_desc[i].length = len;
+			remaining -= len;
+		}
+	}
 
 	self->ref();
 	self->device->ref();
 
 	#ifndef USE_POLL
-	completionQueue.ref();
+	self->device->env->completionQueue.ref();
 	#endif
 
 	DEBUG_LOG("Submitting, %p %p %x %i %i %i %p",
@@ -96,24 +196,35 @@ extern "C" void LIBUSB_CALL usbCompletionCb(libusb_transfer *transfer){
 	#ifdef USE_POLL
 	handleCompletion(t);
 	#else
-	completionQueue.post(t);
+	t->device->env->completionQueue.post(t);
 	#endif
 }
 
 void handleCompletion(Transfer* self){
-	Nan::HandleScope scope;
 	DEBUG_LOG("HandleCompletion %p", self);
 
+	UsbEnv* env = self->device->env;
 	self->device->unref();
 	#ifndef USE_POLL
-	completionQueue.unref();
+	env->completionQueue.unref();
 	#endif
 
+	if (!env->batchHandler.IsEmpty()) {
+		// Keeps its ref until flushCompletions() has handed it to JS
+		env->batchPending.push_back(self);
+		return;
+	}
+
+	deliverCompletion(self);
+}
+
+void deliverCompletion(Transfer* self){
+	Nan::HandleScope scope;
+
 	// The callback may resubmit and overwrite these, so need to clear the
 	// persistent first.
-	Local<Object> buffer = Nan::New<Object>(self->v8buffer);
-	self->v8buffer.Reset();
-	self->transfer->buffer = NULL;
+	Local<Value> buffer = self->transferBuffer();
+	self->releaseBuffer();
 
 	if (!self->v8callback.IsEmpty()) {
 		Local<Value> error = Nan::Undefined();
@@ -121,9 +232,11 @@ void handleCompletion(Transfer* self){
 			error = libusbException(self->transfer->status);
 		}
 		Local<Value> argv[] = {error, buffer,
-			Nan::New<Uint32>((uint32_t) self->transfer->actual_length)};
+			Nan::New<Uint32>((uint32_t) self->transfer->actual_length),
+			self->packetDescriptors()};
 		Nan::TryCatch try_catch;
-		Nan::MakeCallback(self->handle(), Nan::New(self->v8callback), 3, argv);
+		Nan::MakeCallback(self->handle(), Nan::New(self->v8callback),
+			self->transfer->num_iso_packets > 0 ? 4 : 3, argv);
 		if (try_catch.HasCaught()) {
 			Nan::FatalException(try_catch);
 		}
@@ -132,6 +245,71 @@ void handleCompletion(Transfer* self){
 	self->unref();
 }
 
+void flushCompletions(){
+	UsbEnv* env = UsbEnv::current();
+	if (!env || env->batchPending.empty()) return;
+	Nan::HandleScope scope;
+
+	std::vector<Transfer*> pending;
+	pending.swap(env->batchPending);
+
+	if (env->batchHandler.IsEmpty()) {
+		// Batching was turned off while these were queued
+		for (size_t i = 0; i < pending.size(); i++) {
+			deliverCompletion(pending[i]);
+		}
+		return;
+	}
+
+	uint32_t count = (uint32_t) pending.size();
+	Local<Array> transfers = Nan::New<Array>(count);
+	Local<Array> callbacks = Nan::New<Array>(count);
+	Local<Array> errors = Nan::New<Array>(count);
+	Local<Array> buffers = Nan::New<Array>(count);
+	Local<Array> lengths = Nan::New<Array>(count);
+	Local<Array> packets = Nan::New<Array>(count);
+
+	for (uint32_t i = 0; i < count; i++) {
+		Transfer* self = pending[i];
+		transfers->Set(i, self->handle());
+		if (!self->v8callback.IsEmpty()) {
+			callbacks->Set(i, Nan::New(self->v8callback));
+		}
+		if (self->transfer->status != 0){
+			errors->Set(i, libusbException(self->transfer->status));
+		}
+		buffers->Set(i, self->transferBuffer());
+		lengths->Set(i, Nan::New<Uint32>((uint32_t) self->transfer->actual_length));
+		if (self->transfer->num_iso_packets > 0) {
+			packets->Set(i, self->packetDescriptors());
+		}
+
+		// As in deliverCompletion, clear before JS gets a chance to resubmit.
+		// The arrays above keep the objects alive across the unref.
+		self->releaseBuffer();
+		self->unref();
+	}
+
+	Local<Value> argv[] = {transfers, callbacks, errors, buffers, lengths, packets};
+	Nan::TryCatch try_catch;
+	Nan::MakeCallback(Nan::GetCurrentContext()->Global(), Nan::New(env->batchHandler), 6, argv);
+	if (try_catch.HasCaught()) {
+		Nan::FatalException(try_catch);
+	}
+}
+
+// _setCompletionBatchHandler(handler(transfers, callbacks, errors, buffers, lengths, packets) | null)
+NAN_METHOD(SetCompletionBatchHandler){
+	Nan::HandleScope scope;
+	UsbEnv* env = UsbEnv::current();
+	if (info.Length() > 0 && info[0]->IsFunction()) {
+		env->batchHandler.Reset(Local<Function>::Cast(info[0]));
+	} else {
+		env->batchHandler.Reset();
+	}
+	info.GetReturnValue().Set(Nan::Undefined());
+}
+
 NAN_METHOD(Transfer_Cancel){
 	ENTER_METHOD(Transfer, 0);
 	DEBUG_LOG("Cancel %p %i", self, !!self->transfer->buffer);
@@ -154,4 +332,6 @@ void Transfer::Init(Local<Object> target){
 	Nan::SetPrototypeMethod(tpl, "cancel", Transfer_Cancel);
 
 	target->Set(Nan::New("Transfer").ToLocalChecked(), tpl->GetFunction());
+
+	Nan::SetMethod(target, "_setCompletionBatchHandler", SetCompletionBatchHandler);
 }
@@ -3,33 +3,75 @@
 
 #include <uv.h>
 #include <node_version.h>
-#include <queue>
+#include <atomic>
+#include <vector>
 #include "polyfill.h"
+#include "mpsc_queue.h"
+
+#define UVQUEUE_CAPACITY 4096
 
 template <class T>
 class UVQueue{
 	public:
 		typedef void (*fptr)(T);
+		typedef void (*dptr)();
 
-		UVQueue(fptr cb, int _ref_count=0): callback(cb), ref_count(_ref_count) {
-			uv_mutex_init(&mutex);
-			uv_async_init(uv_default_loop(), &async, UVQueue::internal_callback);
+		// `drained` (optional) runs once after each wakeup has emptied the
+		// queue, so consumers can flush work batched up by `callback`.
+		UVQueue(uv_loop_t* loop, fptr cb, int _ref_count=0, dptr _drained=NULL):
+			callback(cb), drained(_drained), ring(UVQUEUE_CAPACITY),
+			spilling(false), pending(false), closed(false), senders(0),
+			ref_count(_ref_count), onClosed(NULL), onClosedArg(NULL) {
+			uv_mutex_init(&spill_mutex);
+			uv_async_init(loop, &async, UVQueue::internal_callback);
 			async.data = this;
 			if (ref_count < 1) {
 				uv_unref((uv_handle_t*)&async);
 			}
 		}
-		
+
+		// Called from the libusb event thread(s). Lock- and allocation-free
+		// unless the ring is full, in which case items go to a mutex-guarded
+		// overflow list until the consumer has caught up, preserving order.
 		void post(T value){
-			uv_mutex_lock(&mutex);
-			queue.push(value);
-			uv_mutex_unlock(&mutex);
-			uv_async_send(&async);
+			if (spilling.load(std::memory_order_acquire) || !ring.push(value)) {
+				uv_mutex_lock(&spill_mutex);
+				spill.push_back(value);
+				spilling.store(true, std::memory_order_release);
+				uv_mutex_unlock(&spill_mutex);
+			}
+
+			// Only the first post after a drain needs to wake the loop. Once
+			// the queue is closed its loop may be gone, so nothing is sent;
+			// close() waits out any sender that got past the check.
+			if (!pending.exchange(true, std::memory_order_acq_rel)) {
+				senders++;
+				if (!closed.load()) {
+					uv_async_send(&async);
+				}
+				senders--;
+			}
 		}
-		
+
+		// Stop waking the loop and close the async handle, e.g. when the
+		// owning environment goes away. Items posted afterwards are dropped.
+		// `done` is called from the loop once the handle is closed, after
+		// which the queue can be deleted if nothing can post to it anymore.
+		void close(void (*done)(void*), void* arg){
+			closed.store(true);
+			while (senders.load() != 0) {}
+			onClosed = done;
+			onClosedArg = arg;
+			uv_close((uv_handle_t*)&async, UVQueue::close_callback);
+		}
+
+		// References still held by work that may post to the queue
+		int refs(){
+			return ref_count;
+		}
+
 		~UVQueue(){
-			uv_mutex_destroy(&mutex);
-			uv_close((uv_handle_t*)&async, NULL); //TODO: maybe we can't delete UVQueue until callback?
+			uv_mutex_destroy(&spill_mutex);
 		}
 
 		void ref(){
@@ -45,28 +87,60 @@ class UVQueue{
 				uv_unref((uv_handle_t*)&async);
 			}
 		}
-		
+
 	private:
 		fptr callback;
-		std::queue<T> queue;
-		uv_mutex_t mutex;
+		dptr drained;
+		MPSCQueue<T> ring;
+		std::vector<T> spill;
+		uv_mutex_t spill_mutex;
+		std::atomic<bool> spilling;
+		std::atomic<bool> pending;
+		std::atomic<bool> closed;
+		std::atomic<int> senders;
 		uv_async_t async;
 		int ref_count;
-		
+		void (*onClosed)(void*);
+		void* onClosedArg;
+
+		static void close_callback(uv_handle_t* handle){
+			UVQueue* uvqueue = static_cast<UVQueue*>(handle->data);
+			if (uvqueue->onClosed) {
+				uvqueue->onClosed(uvqueue->onClosedArg);
+			}
+		}
+
 		static UV_ASYNC_CB(internal_callback){
 			UVQueue* uvqueue = static_cast<UVQueue*>(handle->data);
-			
-			while(1){
-				uv_mutex_lock(&uvqueue->mutex);
-				if (uvqueue->queue.empty()){
-					uv_mutex_unlock(&uvqueue->mutex);
-					break;
-				}
-				T item = uvqueue->queue.front();
-				uvqueue->queue.pop();
-				uv_mutex_unlock(&uvqueue->mutex);
+
+			// Re-arm before draining: anything posted from here on either
+			// gets picked up below or sends a fresh wakeup.
+			uvqueue->pending.exchange(false, std::memory_order_acq_rel);
+
+			T item;
+			while (uvqueue->ring.pop(item)) {
 				uvqueue->callback(item);
 			}
+
+			// A producer's overflow items are newer than anything it got into
+			// the ring, which may sit behind a cell another producer hasn't
+			// published yet. Leave the overflow until the ring is empty; that
+			// producer's post will wake us again.
+			if (uvqueue->spilling.load(std::memory_order_acquire) && uvqueue->ring.empty()) {
+				std::vector<T> overflow;
+				uv_mutex_lock(&uvqueue->spill_mutex);
+				overflow.swap(uvqueue->spill);
+				uvqueue->spilling.store(false, std::memory_order_release);
+				uv_mutex_unlock(&uvqueue->spill_mutex);
+
+				for (size_t i = 0; i < overflow.size(); i++) {
+					uvqueue->callback(overflow[i]);
+				}
+			}
+
+			if (uvqueue->drained) {
+				uvqueue->drained();
+			}
 		}
 };
 
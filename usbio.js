@@ -2,7 +2,10 @@ var path = require('path');
 
 var usb = exports = module.exports = require('./build/Release/usb_bindings');
 var events = require('events');
+var stream = require('stream');
 var util = require('util');
+var RingReader = require('./ring_reader');
+var descriptors = require('./descriptors');
 
 // Check that libusb was initialized.
 if (usb.INIT_ERROR) {
@@ -13,18 +16,103 @@ Object.keys(events.EventEmitter.prototype).forEach(function (key) {
   exports[key] = events.EventEmitter.prototype[key];
 });
 
+exports.RingReader = RingReader;
+exports.ConfigDescriptor = descriptors.ConfigDescriptor;
+
+// Lookups in the native device registry, which hotplug events keep
+// current, so none of these rescan the bus.
+
 // convenience method for finding a device by vendor and product id
 exports.findByIds = function (vid, pid) {
-  var devices = usb.getDeviceList();
+  return usb._findDevices(true, 'ids', vid, pid)[0];
+};
 
-  for (var i = 0; i < devices.length; i++) {
-    var deviceDesc = devices[i].deviceDescriptor;
-    if ((deviceDesc.idVendor == vid) && (deviceDesc.idProduct == pid)) {
-      return devices[i]
-    }
+exports.findAllByIds = function (vid, pid) {
+  return usb._findDevices(false, 'ids', vid, pid);
+};
+
+// Serial numbers need each device opened, which happens off the JS thread
+// before the callback is called. Without a callback, only serial numbers
+// read before are matched.
+exports.findBySerial = function (serial, callback) {
+  serial = String(serial);
+  if (!callback) {
+    return usb._findDevices(true, 'serial', serial)[0];
+  }
+  usb._resolveSerials(function (error) {
+    if (error) return callback(error);
+    callback(undefined, usb._findDevices(true, 'serial', serial)[0]);
+  });
+};
+
+// path is the bus number and port numbers as in sysfs, e.g. '1-2.4'
+exports.findByPath = function (path) {
+  return usb._findDevices(true, 'path', String(path))[0];
+};
+
+// Devices of a class, or with an interface of that class
+exports.findByClass = function (cls) {
+  return usb._findDevices(false, 'class', cls);
+};
+
+// Inventory of attached devices gathered off the JS thread: descriptors,
+// active configuration, port path and speed, and optionally the device's
+// strings. options: vendorId, productId, strings, concurrency (devices
+// read at once; defaults to the number of control-plane threads running).
+exports.enumerate = function (options, callback) {
+  if (typeof options === 'function') {
+    callback = options;
+    options = {};
+  }
+  options = options || {};
+  var any = function (id) { return id === undefined ? -1 : id; };
+  if (options.concurrency !== undefined && !(options.concurrency >= 1)) {
+    throw new TypeError("Concurrency must be at least 1");
   }
+  // 0 has the native side use the number of control-plane threads running
+  usb._enumerate(any(options.vendorId), any(options.productId), !!options.strings, options.concurrency || 0,
+    function (error, entries) {
+      if (entries) {
+        entries.forEach(function (entry) {
+          entry.path = entry.portNumbers.length ?
+            entry.busNumber + '-' + entry.portNumbers.join('.') : '' + entry.busNumber;
+          if (entry.rawConfigDescriptor) {
+            entry.configDescriptor = new descriptors.ConfigDescriptor(entry.rawConfigDescriptor);
+          }
+        });
+      }
+      callback(error, entries);
+    });
 };
 
+// Deliver all transfer completions from one event loop wakeup with a single
+// call into JS, instead of one native->JS callback per transfer.
+exports.setBatchCompletions = function (enable) {
+  usb._setCompletionBatchHandler(enable === false ? null : dispatchCompletions);
+};
+
+function dispatchCompletions(transfers, callbacks, errors, buffers, lengths, packets) {
+  var caught = [];
+  for (var i = 0; i < transfers.length; i++) {
+    if (!callbacks[i]) continue;
+    try {
+      callbacks[i].call(transfers[i], errors[i], buffers[i], lengths[i], packets[i]);
+    } catch (e) {
+      caught.push(e);
+    }
+  }
+  if (!caught.length) return;
+  // Finish the batch, then report every failure as its own uncaught
+  // exception, as one callback per transfer would have: the first from
+  // here, the rest on following ticks
+  caught.slice(1).forEach(function (e) {
+    process.nextTick(function () {
+      throw e;
+    });
+  });
+  throw caught[0];
+}
+
 Object.defineProperty(usb.Device.prototype, "speed", {
   get: function () {
     return this._speed || (this._speed = this.__getSpeed());
@@ -34,7 +122,14 @@ Object.defineProperty(usb.Device.prototype, "speed", {
 usb.Device.prototype.timeout = 1000;
 
 usb.Device.prototype.open = function (defaultConfig) {
-  this.__open();
+  // Devices are spread over the event threads by bus, unless one has been
+  // picked by setting `eventThread` before opening.
+  var eventThread = this.eventThread;
+  if (eventThread === undefined) {
+    eventThread = this.busNumber % usb.getEventThreads();
+  }
+  this._activeConfig = undefined;
+  this.__open(eventThread);
   if (defaultConfig === false) return;
   this.interfaces = [];
   var len = this.configDescriptor.interfaces.length;
@@ -46,11 +141,37 @@ usb.Device.prototype.open = function (defaultConfig) {
 usb.Device.prototype.close = function () {
   this.__close();
   this.interfaces = null
+  this._activeConfig = undefined;
+};
+
+// Raw descriptors of a configuration (the active one by default), read
+// once per device and configuration and cached natively. Don't modify it.
+usb.Device.prototype.getRawConfigDescriptor = function (configValue) {
+  return this.__getConfigBlob(configValue);
 };
 
+// View over getRawConfigDescriptor(), reused while the blob is the same
+usb.Device.prototype.getConfigDescriptor = function (configValue) {
+  var blob = this.__getConfigBlob(configValue);
+  var views = this._configViews || (this._configViews = {});
+  var view = views[blob[5]];
+  if (!view) {
+    view = views[blob[5]] = new descriptors.ConfigDescriptor(blob);
+  }
+  return view;
+};
+
+// Follows the active configuration, so it is current after setConfiguration().
+// The active bConfigurationValue is remembered until the device is opened,
+// closed or configured again, so repeated reads don't ask the OS.
 Object.defineProperty(usb.Device.prototype, "configDescriptor", {
   get: function () {
-    return this._configDescriptor || (this._configDescriptor = this.__getConfigDescriptor())
+    if (this._activeConfig !== undefined) {
+      return this.getConfigDescriptor(this._activeConfig);
+    }
+    var view = this.getConfigDescriptor();
+    this._activeConfig = view.bConfigurationValue;
+    return view;
   }
 });
 
@@ -66,8 +187,6 @@ usb.Device.prototype.interface = function (addr) {
   }
 };
 
-var SETUP_SIZE = usb.LIBUSB_CONTROL_SETUP_SIZE;
-
 usb.Device.prototype.controlTransfer =
   function (bmRequestType, bRequest, wValue, wIndex, data_or_length, callback) {
     var self = this;
@@ -86,33 +205,11 @@ usb.Device.prototype.controlTransfer =
       wLength = data_or_length.length
     }
 
-    // Buffer for the setup packet
-    // http://libusbx.sourceforge.net/api-1.0/structlibusb__control__setup.html
-    var buf = new Buffer(wLength + SETUP_SIZE);
-    buf.writeUInt8(bmRequestType, 0);
-    buf.writeUInt8(bRequest, 1);
-    buf.writeUInt16LE(wValue, 2);
-    buf.writeUInt16LE(wIndex, 4);
-    buf.writeUInt16LE(wLength, 6);
-
-    if (!isIn) {
-      data_or_length.copy(buf, SETUP_SIZE)
-    }
-
-    var transfer = new usb.Transfer(this, 0, usb.LIBUSB_TRANSFER_TYPE_CONTROL, this.timeout,
-      function (error, buf, actual) {
-        if (callback) {
-          if (isIn) {
-            callback.call(self, error, buf.slice(SETUP_SIZE, SETUP_SIZE + actual))
-          } else {
-            callback.call(self, error)
-          }
-        }
-      }
-    );
-
+    // The setup packet is filled in natively, in a pooled buffer, and the
+    // callback is called with the device as `this` and (error, data)
     try {
-      transfer.submit(buf)
+      this.__controlTransfer(bmRequestType, bRequest, wValue, wIndex,
+        isIn ? wLength : data_or_length, this.timeout, callback)
     } catch (e) {
       process.nextTick(function () {
         callback.call(self, e);
@@ -121,25 +218,109 @@ usb.Device.prototype.controlTransfer =
     return this;
   };
 
-usb.Device.prototype.getStringDescriptor = function (desc_index, callback) {
-  var langid = 0x0409;
-  var length = 255;
-  this.controlTransfer(
+// String descriptors are cached natively for as long as the device stays
+// attached, so each is read from the device once.
+function readString(device, index, langid, callback) {
+  device.controlTransfer(
     usb.LIBUSB_ENDPOINT_IN,
     usb.LIBUSB_REQUEST_GET_DESCRIPTOR,
-    ((usb.LIBUSB_DT_STRING << 8) | desc_index),
+    ((usb.LIBUSB_DT_STRING << 8) | index),
     langid,
-    length,
+    255,
     function (error, buf) {
       if (error) return callback(error);
-      callback(undefined, buf.toString('utf16le', 2));
+      var value = device.__cacheStringDescriptor(index, langid, buf);
+      if (value === undefined) return callback(new Error('Invalid string descriptor'));
+      callback(undefined, value);
     }
   );
+}
+
+// Language ids the device has strings in, from string descriptor 0
+usb.Device.prototype.getLanguages = function (callback) {
+  var langids = this.__getCachedString(0, 0);
+  if (langids) return process.nextTick(callback, undefined, langids);
+  readString(this, 0, 0, callback);
+};
+
+// Calls back with the device's first language, or US English if it
+// doesn't list any
+function defaultLangid(device, callback) {
+  device.getLanguages(function (error, langids) {
+    callback(!error && langids.length ? langids[0] : 0x0409);
+  });
+}
+
+usb.Device.prototype.getStringDescriptor = function (desc_index, langid, callback) {
+  if (typeof langid === 'function') {
+    callback = langid;
+    langid = undefined;
+  }
+  var self = this;
+  if (langid === undefined) {
+    return defaultLangid(this, function (langid) {
+      self.getStringDescriptor(desc_index, langid, callback);
+    });
+  }
+  var value = this.__getCachedString(desc_index, langid);
+  if (value !== undefined) return process.nextTick(callback, undefined, value);
+  readString(this, desc_index, langid, callback);
+};
+
+// Read every string the device and active configuration descriptors refer
+// to that isn't cached yet. The requests are all submitted at once rather
+// than one per round trip. Calls back with {index: string}; strings the
+// device fails to return are left out.
+usb.Device.prototype.prefetchStringDescriptors = function (langid, callback) {
+  if (typeof langid === 'function') {
+    callback = langid;
+    langid = undefined;
+  }
+  var self = this;
+  if (langid === undefined) {
+    return defaultLangid(this, function (langid) {
+      self.prefetchStringDescriptors(langid, callback);
+    });
+  }
+
+  var dd = this.deviceDescriptor;
+  var indexes = [dd.iManufacturer, dd.iProduct, dd.iSerialNumber];
+  try {
+    var config = this.configDescriptor;
+    indexes.push(config.iConfiguration);
+    config.interfaces.forEach(function (alts) {
+      alts.forEach(function (alt) { indexes.push(alt.iInterface); });
+    });
+  } catch (e) {
+    // Unconfigured: only the device descriptor's strings
+  }
+
+  var strings = {}, pending = 1;
+  function done() {
+    if (--pending === 0) callback(undefined, strings);
+  }
+  indexes.forEach(function (index) {
+    if (!index || index in strings) return;
+    var value = self.__getCachedString(index, langid);
+    if (value !== undefined) {
+      strings[index] = value;
+      return;
+    }
+    strings[index] = undefined;
+    pending++;
+    readString(self, index, langid, function (error, value) {
+      if (error) delete strings[index]; else strings[index] = value;
+      done();
+    });
+  });
+  process.nextTick(done);
 };
 
 usb.Device.prototype.setConfiguration = function(desired, cb) {
   var self = this;
+  this._activeConfig = undefined;
   this.__setConfiguration(desired, function(err) {
+    this._activeConfig = undefined;
     if (!err) {
       this.interfaces = [];
       var len = this.configDescriptor.interfaces.length;
@@ -246,6 +427,27 @@ Interface.prototype.setAltSetting = function (altSetting, cb) {
 
 };
 
+// Allocate USB 3 bulk streams on the given endpoints (default: all bulk
+// endpoints of this interface). Returns the number of streams allocated,
+// which may be lower than requested; valid stream ids are 1..n.
+Interface.prototype.allocStreams = function (numStreams, endpoints) {
+  endpoints = this.__streamEndpoints(endpoints);
+  return this.streamCount = this.device.__allocStreams(numStreams, endpoints);
+};
+
+Interface.prototype.freeStreams = function (endpoints) {
+  this.device.__freeStreams(this.__streamEndpoints(endpoints));
+  this.streamCount = 0;
+};
+
+Interface.prototype.__streamEndpoints = function (endpoints) {
+  return (endpoints || this.endpoints.filter(function (ep) {
+    return ep.transferType == usb.LIBUSB_TRANSFER_TYPE_BULK;
+  })).map(function (ep) {
+    return typeof ep == 'number' ? ep : ep.address;
+  });
+};
+
 Interface.prototype.endpoint = function (addr) {
   for (var i = 0; i < this.endpoints.length; i++) {
     if (this.endpoints[i].address == addr) {
@@ -264,11 +466,29 @@ util.inherits(Endpoint, events.EventEmitter);
 
 Endpoint.prototype.timeout = 0;
 
-Endpoint.prototype.makeTransfer = function (timeout, callback) {
+Object.defineProperty(Endpoint.prototype, "isochronous", {
+  get: function () {
+    return this.transferType == usb.LIBUSB_TRANSFER_TYPE_ISOCHRONOUS;
+  }
+});
+
+// Largest packet the endpoint can carry per (micro)frame, taking
+// high-bandwidth multipliers into account
+Object.defineProperty(Endpoint.prototype, "maxIsoPacketSize", {
+  get: function () {
+    return this._maxIsoPacketSize ||
+      (this._maxIsoPacketSize = this.device.__getMaxIsoPacketSize(this.address));
+  }
+});
+
+Endpoint.prototype.makeTransfer = function (timeout, callback, isoPackets) {
+  if (isoPackets) {
+    return new usb.Transfer(this.device, this.address, this.transferType, timeout, callback, isoPackets)
+  }
   return new usb.Transfer(this.device, this.address, this.transferType, timeout, callback)
 };
 
-Endpoint.prototype.startPoll = function (nTransfers, transferSize, callback) {
+Endpoint.prototype.startPoll = function (nTransfers, transferSize, callback, isoPackets) {
   if (this.pollTransfers) {
     throw new Error("Polling already active")
   }
@@ -280,12 +500,18 @@ Endpoint.prototype.startPoll = function (nTransfers, transferSize, callback) {
 
   var transfers = [];
   for (var i = 0; i < nTransfers; i++) {
-    transfers[i] = this.makeTransfer(0, callback)
+    transfers[i] = this.makeTransfer(0, callback, isoPackets)
   }
   return transfers;
 };
 
 Endpoint.prototype.stopPoll = function (cb) {
+  if (this.pollStream) {
+    this.pollActive = false;
+    if (cb) this.once('end', cb);
+    this.pollStream.stop();
+    return;
+  }
   if (!this.pollTransfers) {
     throw new Error('Polling is not active.');
   }
@@ -308,16 +534,28 @@ exports.InEndpoint = InEndpoint;
 util.inherits(InEndpoint, Endpoint);
 InEndpoint.prototype.direction = "in";
 
-InEndpoint.prototype.transfer = function (length, cb) {
+InEndpoint.prototype.transfer = function (length, cb, streamId) {
   var self = this;
+  var isoPackets = 0;
+
+  if (this.isochronous) {
+    // Whole packets only; data for packet i starts at i * maxIsoPacketSize
+    var packetSize = this.maxIsoPacketSize;
+    isoPackets = Math.max(1, Math.ceil(length / packetSize));
+    length = isoPackets * packetSize;
+  }
   var buffer = new Buffer(length);
 
-  function callback(error, buf, actual) {
-    cb.call(self, error, buffer.slice(0, actual))
+  function callback(error, buf, actual, packets) {
+    if (packets) {
+      cb.call(self, error, buffer, packets)
+    } else {
+      cb.call(self, error, buffer.slice(0, actual))
+    }
   }
 
   try {
-    this.makeTransfer(this.timeout, callback).submit(buffer)
+    this.makeTransfer(this.timeout, callback, isoPackets).submit(buffer, streamId)
   } catch (e) {
     process.nextTick(function () {
       cb.call(self, e);
@@ -326,13 +564,34 @@ InEndpoint.prototype.transfer = function (length, cb) {
   return this;
 };
 
-InEndpoint.prototype.startPoll = function (nTransfers, transferSize) {
+// Read on one of the bulk streams allocated with Interface.allocStreams
+InEndpoint.prototype.transferOnStream = function (streamId, length, cb) {
+  return this.transfer(length, cb, streamId);
+};
+
+InEndpoint.prototype.startPoll = function (nTransfers, transferSize, options) {
+  if (options && (options.native || options.pool)) {
+    if (this.isochronous) {
+      throw new Error("Native polling does not support isochronous endpoints")
+    }
+    return this.__startNativePoll(nTransfers, transferSize, options);
+  }
+
   var self = this;
-  this.pollTransfers = InEndpoint.super_.prototype.startPoll.call(this, nTransfers, transferSize, transferDone)
+  var isoPackets = 0;
+  if (this.isochronous) {
+    isoPackets = (options && options.isoPackets) || 8;
+    transferSize = isoPackets * this.maxIsoPacketSize;
+  }
+  this.pollTransfers = InEndpoint.super_.prototype.startPoll.call(this, nTransfers, transferSize, transferDone, isoPackets)
 
-  function transferDone(error, buf, actual) {
+  function transferDone(error, buf, actual, packets) {
     if (!error) {
-      self.emit("data", buf.slice(0, actual))
+      if (packets) {
+        self.emit("data", buf, packets)
+      } else {
+        self.emit("data", buf.slice(0, actual))
+      }
     } else if (error.errno != usb.LIBUSB_TRANSFER_CANCELLED) {
       self.emit("error", error);
       self.stopPoll();
@@ -344,6 +603,8 @@ InEndpoint.prototype.startPoll = function (nTransfers, transferSize) {
       self.pollPending--;
 
       if (self.pollPending == 0) {
+        // Allow polling to be restarted from the 'end' handler
+        self.pollTransfers = null;
         self.emit('end');
       }
     }
@@ -362,6 +623,118 @@ InEndpoint.prototype.startPoll = function (nTransfers, transferSize) {
   self.pollPending = this.pollTransfers.length;
 };
 
+// Polling driven by the native InStream: transfers are resubmitted on the
+// libusb event thread from a ring of `nBuffers` preallocated slots, so the
+// endpoint stays armed even while the JS thread is busy.
+InEndpoint.prototype.__startNativePoll = function (nTransfers, transferSize, options) {
+  if (this.pollTransfers || this.pollStream) {
+    throw new Error("Polling already active")
+  }
+
+  var self = this;
+  nTransfers = nTransfers || 3;
+  var size = this.pollTransferSize = transferSize || this.descriptor.wMaxPacketSize;
+  var nBuffers = options.nBuffers || 2 * nTransfers;
+  var pool = !!options.pool;
+
+  // In pool mode one slab backs every slot and the per-slot Buffers are
+  // made once here, so steady-state streaming allocates nothing.
+  var slab = new Buffer(nBuffers * size);
+  var buffers = null;
+  if (pool) {
+    buffers = [];
+    for (var i = 0; i < nBuffers; i++) {
+      buffers[i] = slab.slice(i * size, (i + 1) * size);
+    }
+  }
+
+  var stream = new usb.InStream(this.device, this.address, this.transferType, 0,
+    size, nTransfers, slab, pool ? onSlot : onData, onEnd, pool);
+
+  function onData(error, buf, actual) {
+    if (!error) {
+      self.emit("data", buf)
+    } else {
+      onError(error);
+    }
+  }
+
+  function onSlot(error, slot, actual) {
+    if (!error) {
+      // The stream goes with the slot, so a release can't reach a later poll
+      self.emit("data", buffers[slot], actual, slot, stream)
+    } else {
+      onError(error);
+    }
+  }
+
+  function onError(error) {
+    self.emit("error", error);
+    if (self.pollActive) self.stopPoll();
+  }
+
+  function onEnd() {
+    if (self.pollStream !== stream) return;
+    self.pollStream = null;
+    self.pollActive = false;
+    self.emit('end');
+  }
+
+  stream.start();
+  this.pollStream = stream;
+  this.pollBuffers = buffers;
+  this.pollActive = true;
+};
+
+// Hand a pool slot received in a 'data' event back for reuse, along with
+// the stream that came with it. Slots still held when polling ends are
+// freed with the pool, so releasing them then does nothing, even once a
+// new poll has started and handed out the same slot numbers.
+InEndpoint.prototype.releasePollBuffer = function (slot, stream) {
+  if (!(stream instanceof usb.InStream)) {
+    throw new TypeError("Pass the stream from the 'data' event");
+  }
+  if (stream !== this.pollStream) return;
+  stream.release(slot);
+};
+
+// Counters of the native poll stream: completed transfers, overruns (a
+// transfer completed while every buffer slot was still held by JS), and the
+// current number of transfers in flight and free slots.
+InEndpoint.prototype.getPollStats = function () {
+  return this.pollStream ? this.pollStream.stats() : null;
+};
+
+// Stream the endpoint into a SharedArrayBuffer ring, read with
+// usb.RingReader from any thread. Transfers are resubmitted on the libusb
+// event thread and JS is only entered to wake a reader that is sleeping.
+InEndpoint.prototype.startRing = function (options, callback) {
+  if (typeof options === 'function') {
+    callback = options;
+    options = {};
+  }
+  options = options || {};
+  var self = this;
+  var buffer = options.buffer;
+  var slots, slotSize;
+  if (buffer) {
+    var reader = new RingReader(buffer);
+    slots = reader.slots;
+    slotSize = reader.slotSize;
+  } else {
+    slots = options.slots || 64;
+    slotSize = options.slotSize || this.descriptor.wMaxPacketSize;
+    buffer = RingReader.create(slots, slotSize);
+  }
+
+  var header = new Int32Array(buffer, 0, 1);
+  var ring = new usb.RingStream(this.device, this.address, this.transferType,
+    options.timeout || 0, slotSize, slots, options.transfers || 4, buffer,
+    function () { RingReader.wake(header); },
+    function (error) { if (callback) callback.call(self, error); });
+  return ring.start();
+};
+
 InEndpoint.prototype.pollStart = function (size, timeout) {
   if (this._pollActive) return false;
 
@@ -372,10 +745,16 @@ InEndpoint.prototype.pollStart = function (size, timeout) {
   this._pollActive = true;
   var poller = this.poller = new usb.Poller(this.device, this.address, this.descriptor.bmAttributes, timeout, done);
 
-  function done(err, buf, count) {
+  if (this.isochronous) {
+    size = Math.max(1, Math.ceil(size / this.maxIsoPacketSize)) * this.maxIsoPacketSize;
+  }
+
+  function done(err, buf, count, packets) {
     if (err) {
       that.emit('error', err);
       that.pollStop();
+    } else if (packets) {
+      that.emit("data", buf, packets)
     } else {
       that.emit("data", buf.slice(0, count))
     }
@@ -418,20 +797,34 @@ exports.OutEndpoint = OutEndpoint;
 util.inherits(OutEndpoint, Endpoint);
 OutEndpoint.prototype.direction = "out";
 
-OutEndpoint.prototype.transfer = function (buffer, cb) {
+OutEndpoint.prototype.transfer = function (buffer, cb, streamId) {
   var self = this;
+  var length;
   if (!buffer) {
     buffer = new Buffer(0)
+  } else if (Array.isArray(buffer) && Buffer.isBuffer(buffer[0])) {
+    // An array of Buffers (as opposed to an array of byte values) is
+    // gathered natively into one transfer, without a Buffer.concat copy
+    length = 0;
+    for (var i = 0; i < buffer.length; i++) {
+      length += buffer[i].length;
+    }
   } else if (!Buffer.isBuffer(buffer)) {
     buffer = new Buffer(buffer)
   }
+  if (length === undefined) length = buffer.length;
 
   function callback(error, buf, actual) {
     if (cb) cb.call(self, error)
   }
 
+  var isoPackets = 0;
+  if (this.isochronous) {
+    isoPackets = Math.max(1, Math.ceil(length / this.maxIsoPacketSize));
+  }
+
   try {
-    this.makeTransfer(this.timeout, callback).submit(buffer);
+    this.makeTransfer(this.timeout, callback, isoPackets).submit(buffer, streamId);
   } catch (e) {
     process.nextTick(function () {
       callback(e);
@@ -441,6 +834,11 @@ OutEndpoint.prototype.transfer = function (buffer, cb) {
   return this;
 };
 
+// Write on one of the bulk streams allocated with Interface.allocStreams
+OutEndpoint.prototype.transferOnStream = function (streamId, buffer, cb) {
+  return this.transfer(buffer, cb, streamId);
+};
+
 OutEndpoint.prototype.transferWithZLP = function (buf, cb) {
   if (buf.length % this.descriptor.wMaxPacketSize == 0) {
     this.transfer(buf);
@@ -450,6 +848,215 @@ OutEndpoint.prototype.transferWithZLP = function (buf, cb) {
   }
 }
 
+// Coalesce small writes: they are copied into a shared transfer that is
+// sent once `maxSize` bytes have gathered or `delay` ms after the first
+// write, with at most `transfers` transfers in flight. Each write's
+// callback still fires individually, in order.
+OutEndpoint.prototype.createChannel = function (options) {
+  options = options || {};
+  var channel = new usb.OutChannel(this.device, this.address, this.transferType, this.timeout,
+    options.maxSize || 4096, options.delay == null ? 1 : options.delay, options.transfers || 4, onBatch);
+  // Callbacks by write number, which counts writes like the native side
+  channel._callbacks = {};
+  channel._written = 0;
+
+  function onBatch(error, first, writes) {
+    var callbacks = [];
+    for (var i = 0; i < writes; i++) {
+      var seq = (first + i) >>> 0;
+      callbacks.push(this._callbacks[seq]);
+      delete this._callbacks[seq];
+    }
+    function done() {
+      for (var i = 0; i < callbacks.length; i++) {
+        if (callbacks[i]) callbacks[i](error);
+      }
+    }
+    // A batch that couldn't be submitted fails from inside write() or
+    // flush(); report it on a later tick like Transfer.submit errors
+    if (error) {
+      process.nextTick(done);
+    } else {
+      done();
+    }
+  }
+
+  return channel;
+};
+
+usb.OutChannel.prototype.write = function (data, cb) {
+  if (!Buffer.isBuffer(data)) {
+    data = new Buffer(data)
+  }
+  var seq = this._written;
+  this._callbacks[seq] = cb;
+  try {
+    this.__write(data);
+  } catch (e) {
+    delete this._callbacks[seq];
+    throw e;
+  }
+  this._written = (seq + 1) >>> 0;
+  return this;
+};
+
+InEndpoint.prototype.createReadStream = function (options) {
+  return new InEndpointReadStream(this, options);
+};
+
+OutEndpoint.prototype.createWriteStream = function (options) {
+  return new OutEndpointWriteStream(this, options);
+};
+
+// Readable stream over an IN endpoint. Up to `transfers` reads of
+// `transferSize` bytes are kept in flight, by default just enough to fill
+// highWaterMark, and a read is only resubmitted while the consumer asks for
+// more. Buffered plus in-flight data is thus bounded by roughly twice the
+// highWaterMark however slow the consumer is.
+function InEndpointReadStream(endpoint, options) {
+  options = options || {};
+  stream.Readable.call(this, {highWaterMark: options.highWaterMark});
+
+  this.endpoint = endpoint;
+  this.transferSize = options.transferSize || endpoint.descriptor.wMaxPacketSize;
+  var nTransfers = options.transfers ||
+    Math.max(1, Math.ceil(this._readableState.highWaterMark / this.transferSize));
+
+  this._idle = [];
+  this._active = [];
+  for (var i = 0; i < nTransfers; i++) {
+    this._idle.push(endpoint.makeTransfer(endpoint.timeout, onTransfer));
+  }
+  this._wanted = false;
+  this._stopping = false;
+  this._ended = false;
+  this._destroyed = null;
+
+  var self = this;
+  function onTransfer(error, buf, actual) {
+    self._active.splice(self._active.indexOf(this), 1);
+    self._idle.push(this);
+
+    if (error && error.errno != usb.LIBUSB_TRANSFER_CANCELLED) {
+      self.emit('error', error);
+      self.stop();
+    } else if (!error && !self._stopping) {
+      self._wanted = self.push(buf.slice(0, actual));
+    }
+    self._fill();
+  }
+}
+util.inherits(InEndpointReadStream, stream.Readable);
+exports.InEndpointReadStream = InEndpointReadStream;
+
+InEndpointReadStream.prototype._read = function () {
+  this._wanted = true;
+  this._fill();
+};
+
+InEndpointReadStream.prototype._fill = function () {
+  if (this._stopping) {
+    if (this._active.length == 0 && !this._ended) {
+      this._ended = true;
+      if (this._destroyed) {
+        this._destroyed();
+      } else {
+        this.push(null);
+      }
+    }
+    return;
+  }
+
+  while (this._wanted && this._idle.length) {
+    var t = this._idle.pop();
+    try {
+      t.submit(new Buffer(this.transferSize));
+    } catch (e) {
+      this._idle.push(t);
+      this.emit('error', e);
+      return this.stop();
+    }
+    this._active.push(t);
+  }
+};
+
+// Cancel outstanding reads and end the stream once they have completed
+InEndpointReadStream.prototype.stop = function () {
+  if (this._stopping) return;
+  this._stopping = true;
+  this._active.forEach(function (t) {
+    t.cancel();
+  });
+  this._fill();
+};
+
+// destroy() (Node >= 8) cancels outstanding reads like stop(), but only
+// closes once they have completed, so no transfer outlives the stream
+InEndpointReadStream.prototype._destroy = function (err, cb) {
+  if (this._ended) return cb(err);
+  this._destroyed = function () {
+    cb(err);
+  };
+  this.stop();
+};
+
+// Writable stream over an OUT endpoint. Each chunk is submitted as one
+// transfer right away, but its write callback is held while the bytes in
+// flight exceed highWaterMark, so a fast producer sees backpressure
+// instead of queueing unbounded transfers.
+function OutEndpointWriteStream(endpoint, options) {
+  options = options || {};
+  stream.Writable.call(this, {highWaterMark: options.highWaterMark});
+
+  this.endpoint = endpoint;
+  this._inFlight = 0;
+  this._limit = this._writableState.highWaterMark;
+  this._held = null;
+  this._error = null;
+  this._flushed = null;
+}
+util.inherits(OutEndpointWriteStream, stream.Writable);
+exports.OutEndpointWriteStream = OutEndpointWriteStream;
+
+OutEndpointWriteStream.prototype._write = function (chunk, encoding, cb) {
+  if (this._error) return cb(this._error);
+
+  var self = this;
+  var length = chunk.length;
+  this._inFlight += length;
+  this.endpoint.transfer(chunk, function (error) {
+    self._inFlight -= length;
+    if (error && !self._error) self._error = error;
+    self._release();
+  });
+
+  if (this._inFlight > this._limit) {
+    this._held = cb;
+  } else {
+    cb();
+  }
+};
+
+OutEndpointWriteStream.prototype._release = function () {
+  var cb;
+  if (this._held && (this._error || this._inFlight <= this._limit)) {
+    cb = this._held;
+    this._held = null;
+    cb(this._error);
+  }
+  if (this._flushed && this._inFlight == 0) {
+    cb = this._flushed;
+    this._flushed = null;
+    cb(this._error);
+  }
+};
+
+// 'finish' waits for the last transfers to complete (Node >= 8)
+OutEndpointWriteStream.prototype._final = function (cb) {
+  this._flushed = cb;
+  this._release();
+};
+
 var hotplugListeners = 0;
 exports.on('newListener', function (name) {
   if (name !== 'attach' && name !== 'detach') return;